@@ -0,0 +1,109 @@
+#include <stdlib.h>
+#include "arena.h"
+
+#define ARENA_CHUNK_SIZE (1024 * 1024)
+
+/* every allocation is aligned for doubles and pointers */
+union arena_align_u
+{
+    double d;
+    long l;
+    void *p;
+};
+
+#define ARENA_ALIGN sizeof(union arena_align_u)
+#define ARENA_HEADER \
+    ((sizeof(struct arena_chunk_s) + ARENA_ALIGN - 1) / ARENA_ALIGN * \
+     ARENA_ALIGN)
+
+static struct arena_chunk_s *new_arena_chunk(size_t);
+
+void init_arena_s(struct arena_s *arena)
+{
+    arena->chunks = arena->current = NULL;
+    arena->n_chunks = 0;
+    arena->n_allocs = arena->n_bytes = 0;
+}
+
+void free_arena_s(struct arena_s *arena)
+{
+    struct arena_chunk_s *chunk = arena->chunks;
+
+    while (chunk) {
+        struct arena_chunk_s *next = chunk->next;
+
+        free(chunk);
+        chunk = next;
+    }
+    init_arena_s(arena);
+}
+
+/* forget every allocation, but keep the chunks for reuse */
+void reset_arena_s(struct arena_s *arena)
+{
+    arena->current = arena->chunks;
+    if (arena->current)
+        arena->current->used = 0;
+    arena->n_allocs = arena->n_bytes = 0;
+}
+
+void *arena_alloc(struct arena_s *arena, size_t size)
+{
+    struct arena_chunk_s *chunk = arena->current;
+    void *p;
+
+    size = (size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+
+    if (!chunk || chunk->used + size > chunk->size) {
+        /* move on to the next kept chunk if it is large enough, or else
+         * insert a new one after the current chunk */
+        if (chunk && chunk->next && size <= chunk->next->size)
+            chunk = chunk->next;
+        else {
+            struct arena_chunk_s *new_chunk =
+                new_arena_chunk(size > ARENA_CHUNK_SIZE ? size :
+                                ARENA_CHUNK_SIZE);
+
+            if (chunk) {
+                new_chunk->next = chunk->next;
+                chunk->next = new_chunk;
+            }
+            else
+                arena->chunks = new_chunk;
+            chunk = new_chunk;
+            arena->n_chunks++;
+        }
+        chunk->used = 0;
+        arena->current = chunk;
+    }
+
+    p = (char *)chunk + ARENA_HEADER + chunk->used;
+    chunk->used += size;
+    arena->n_allocs++;
+    arena->n_bytes += size;
+
+    return p;
+}
+
+/* return the bytes held by the chunks */
+size_t arena_size(struct arena_s *arena)
+{
+    struct arena_chunk_s *chunk;
+    size_t size = 0;
+
+    for (chunk = arena->chunks; chunk; chunk = chunk->next)
+        size += ARENA_HEADER + chunk->size;
+
+    return size;
+}
+
+static struct arena_chunk_s *new_arena_chunk(size_t size)
+{
+    struct arena_chunk_s *chunk = malloc(ARENA_HEADER + size);
+
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+
+    return chunk;
+}
@@ -0,0 +1,24 @@
+struct arena_chunk_s
+{
+    struct arena_chunk_s *next;
+    size_t size;
+    size_t used;
+};
+
+/* bump allocator that hands out memory from a list of chunks and frees all
+ * of it at once */
+struct arena_s
+{
+    struct arena_chunk_s *chunks;       /* first chunk */
+    struct arena_chunk_s *current;      /* chunk being filled */
+    int n_chunks;
+    size_t n_allocs;            /* allocations since the last reset */
+    size_t n_bytes;             /* bytes handed out since the last reset */
+};
+
+/* arena.c */
+void init_arena_s(struct arena_s *);
+void free_arena_s(struct arena_s *);
+void reset_arena_s(struct arena_s *);
+void *arena_alloc(struct arena_s *, size_t);
+size_t arena_size(struct arena_s *);
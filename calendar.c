@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "global.h"
+#include "vic.h"
+
+/* STANDARD is treated as GREGORIAN for all years, as in the VIC drivers
+ * after 1582 */
+static int is_leap_year(enum calendar calendar, int year)
+{
+    switch (calendar) {
+    case NOLEAP:
+    case DAY_365:
+    case DAY_360:
+        return 0;
+    case ALL_LEAP:
+    case DAY_366:
+        return 1;
+    case JULIAN:
+        return year % 4 == 0;
+    default:
+        return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    }
+}
+
+int days_in_month(enum calendar calendar, int year, int month)
+{
+    static const int days[] =
+        { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+    if (month < 1 || month > 12)
+        error("Invalid month: %d\n", month);
+
+    if (calendar == DAY_360)
+        return 30;
+
+    return days[month - 1] + (month == 2 && is_leap_year(calendar, year));
+}
+
+int days_in_year(enum calendar calendar, int year)
+{
+    if (calendar == DAY_360)
+        return 360;
+
+    return 365 + is_leap_year(calendar, year);
+}
+
+/* days from 0001-01-01 to year-month-day; day may run past the end of the
+ * month */
+long date_to_days(enum calendar calendar, int year, int month, int day)
+{
+    long days = day - 1;
+    int i;
+
+    for (i = 1; i < year; i++)
+        days += days_in_year(calendar, i);
+    for (i = 1; i < month; i++)
+        days += days_in_month(calendar, year, i);
+
+    return days;
+}
+
+/* name of the calendar attribute in the CF conventions */
+const char *calendar_name(enum calendar calendar)
+{
+    switch (calendar) {
+    case STANDARD:
+        return "standard";
+    case GREGORIAN:
+        return "gregorian";
+    case PROLEPTIC_GREGORIAN:
+        return "proleptic_gregorian";
+    case NOLEAP:
+        return "noleap";
+    case DAY_365:
+        return "365_day";
+    case DAY_360:
+        return "360_day";
+    case JULIAN:
+        return "julian";
+    case ALL_LEAP:
+        return "all_leap";
+    case DAY_366:
+        return "366_day";
+    }
+
+    return "standard";
+}
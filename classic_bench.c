@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "global.h"
+#include "vic.h"
+
+/* time each stage of the conversion of a classic dataset, such as one from
+ * classic_gen, with --threads threads, one by default, and append them to a
+ * tab-separated results file with a header line if it is new; with
+ * --max-memory, the soil and vegetation parameter stages only scan the
+ * files and the parameters stage reads the cells too, as in streaming
+ * mode */
+
+static double elapsed(struct timespec *);
+
+int main(int argc, char **argv)
+{
+    struct global_params_s *gp;
+    struct soil_s *soil;
+    struct veg_lib_s *veg_lib;
+    struct veg_params_s *veg_params;
+    struct timespec start;
+    double soil_time, veg_lib_time, veg_params_time, domain_time,
+        params_time;
+    struct stat st;
+    size_t max_memory = 0;
+    int threads = 1;
+    FILE *fp;
+    int i;
+
+    for (i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--max-memory") == 0)
+            max_memory = read_size(argv[i + 1]);
+        else if (strcmp(argv[i], "--threads") == 0)
+            threads = read_threads(argv[i + 1]);
+        else
+            break;
+    }
+
+    if (argc - i != 3)
+        error
+            ("Usage: classic_bench [--max-memory size[K|M|G]] [--threads n] classic_global.txt image_prefix results.tsv\n");
+
+    gp = read_global_params(argv[i]);
+    if (!is_classic(gp))
+        error("Not a classic global parameters file: %s\n", argv[i]);
+    populate_image_global_params(gp, argv[i + 1]);
+    gp->max_memory = max_memory;
+    gp->threads = threads;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    soil = max_memory ? scan_classic_soil(gp) : read_classic_soil(gp);
+    soil_time = elapsed(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    veg_lib = read_classic_veg_lib(gp);
+    veg_lib_time = elapsed(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    veg_params = max_memory ? scan_classic_veg_params(gp) :
+        read_classic_veg_params(gp);
+    veg_params_time = elapsed(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    create_image_domain(gp, soil->domain);
+    domain_time = elapsed(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    create_image_params(gp, soil, veg_lib, veg_params, NULL);
+    params_time = elapsed(&start);
+
+    if (!(fp = fopen(argv[i + 2], "a")))
+        error("Cannot open file: %s\n", argv[i + 2]);
+    if (fstat(fileno(fp), &st) == 0 && st.st_size == 0)
+        fprintf(fp, "cells\tnlayer\tmax_memory\tthreads\tsoil_s\t"
+                "veg_lib_s\tveg_params_s\tdomain_s\tparams_s\n");
+    fprintf(fp, "%d\t%d\t%zu\t%d\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\n",
+            soil->n_cells, gp->nlayer, max_memory, threads, soil_time,
+            veg_lib_time, veg_params_time, domain_time, params_time);
+    if (fclose(fp))
+        error("Cannot write file: %s\n", argv[i + 2]);
+
+    printf("%d cells: soil %.3f s, veg_lib %.3f s, veg_params %.3f s, "
+           "domain %.3f s, params %.3f s\n", soil->n_cells, soil_time,
+           veg_lib_time, veg_params_time, domain_time, params_time);
+
+    free_global_params(gp);
+    free_soil(soil);
+    free_veg_lib(veg_lib);
+    free_veg_params(veg_params);
+
+    return 0;
+}
+
+static double elapsed(struct timespec *start)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return end.tv_sec - start->tv_sec + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
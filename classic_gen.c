@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "global.h"
+
+/* synthetic classic dataset of a given number of cells for benchmarks: a
+ * global parameters file and the soil, vegetation library and vegetation
+ * parameter files it names, with random values; the cells fill a 1/16
+ * degree grid about twice as wide as high, row by row, and the same options
+ * give the same files */
+
+#define N_CLASSES 11
+#define N_MONTHS 12
+#define RESOLUTION 0.0625
+
+struct gen_s
+{
+    long n_cells;
+    int nlat, nlon;
+    int nlayer;
+    int nveg;                   /* vegetation tiles per cell */
+    int root_zones;
+    int organic_fract;
+    int spatial_frost;
+    int july_tavg_supplied;
+    int veglib_fcan;
+    int veglib_photo;
+    int vegparam_lai;
+    int vegparam_fcan;
+    int vegparam_alb;
+    int blowing;
+    const char *dir;
+    char *line;
+};
+
+static long read_count(const char *);
+static FILE *create_file(struct gen_s *, const char *, char *);
+static void write_global(struct gen_s *);
+static void write_soil(struct gen_s *);
+static void write_veg_lib(struct gen_s *);
+static void write_veg_params(struct gen_s *);
+static char *put_values(char *, int);
+static char *put_value(char *, int);
+
+int main(int argc, char **argv)
+{
+    struct gen_s gen;
+    long seed = 1;
+    int i = 1;
+
+    memset(&gen, 0, sizeof gen);
+    gen.n_cells = 1000;
+    gen.nlayer = 3;
+    gen.nveg = 3;
+    gen.root_zones = 3;
+
+    while (i < argc && strncmp(argv[i], "--", 2) == 0) {
+        if (strcmp(argv[i], "--cells") == 0 && i + 1 < argc)
+            gen.n_cells = read_count(argv[++i]);
+        else if (strcmp(argv[i], "--nlayer") == 0 && i + 1 < argc)
+            gen.nlayer = read_count(argv[++i]);
+        else if (strcmp(argv[i], "--nveg") == 0 && i + 1 < argc)
+            gen.nveg = read_count(argv[++i]);
+        else if (strcmp(argv[i], "--root-zones") == 0 && i + 1 < argc)
+            gen.root_zones = read_count(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            seed = read_count(argv[++i]);
+        else if (strcmp(argv[i], "--organic-fract") == 0)
+            gen.organic_fract = 1;
+        else if (strcmp(argv[i], "--spatial-frost") == 0)
+            gen.spatial_frost = 1;
+        else if (strcmp(argv[i], "--july-tavg") == 0)
+            gen.july_tavg_supplied = 1;
+        else if (strcmp(argv[i], "--veglib-fcan") == 0)
+            gen.veglib_fcan = 1;
+        else if (strcmp(argv[i], "--veglib-photo") == 0)
+            gen.veglib_photo = 1;
+        else if (strcmp(argv[i], "--lai") == 0)
+            gen.vegparam_lai = 1;
+        else if (strcmp(argv[i], "--fcan") == 0)
+            gen.vegparam_fcan = 1;
+        else if (strcmp(argv[i], "--albedo") == 0)
+            gen.vegparam_alb = 1;
+        else if (strcmp(argv[i], "--blowing") == 0)
+            gen.blowing = 1;
+        else
+            error("Invalid option: %s\n", argv[i]);
+        i++;
+    }
+
+    if (argc - i != 1)
+        error
+            ("Usage: classic_gen [--cells n] [--nlayer n] [--nveg n] [--root-zones n] [--seed n] [--organic-fract] [--spatial-frost] [--july-tavg] [--veglib-fcan] [--veglib-photo] [--lai] [--fcan] [--albedo] [--blowing] dir\n");
+    gen.dir = argv[i];
+
+    if (!gen.n_cells || !gen.nlayer || !gen.root_zones)
+        error("Invalid number of cells, layers or root zones\n");
+    if (gen.nveg > N_CLASSES)
+        error("Invalid number of vegetation tiles: %d > %d classes\n",
+              gen.nveg, N_CLASSES);
+
+    /* at least two lat rows give the resolution */
+    gen.nlat = 2;
+    while (2.0 * gen.nlat * gen.nlat < gen.n_cells)
+        gen.nlat++;
+    gen.nlon = (gen.n_cells + gen.nlat - 1) / gen.nlat;
+
+    if (mkdir(gen.dir, 0777) && errno != EEXIST)
+        error("Cannot create directory: %s\n", gen.dir);
+
+    /* no line has more than 20 values per layer or root zone and 70 others,
+     * each of at most 12 characters */
+    gen.line = malloc(12 * (20 * (gen.nlayer + gen.root_zones) + 70));
+
+    srand(seed);
+    write_global(&gen);
+    write_soil(&gen);
+    write_veg_lib(&gen);
+    write_veg_params(&gen);
+
+    printf("%ld cells on %d x %d grid in %s\n", gen.n_cells, gen.nlat,
+           gen.nlon, gen.dir);
+
+    free(gen.line);
+
+    return 0;
+}
+
+static long read_count(const char *buf)
+{
+    long count;
+    char c;
+
+    if (sscanf(buf, "%ld%c", &count, &c) != 1 || count < 0)
+        error("Invalid count: %s\n", buf);
+
+    return count;
+}
+
+/* create dir/name and return its path in path */
+static FILE *create_file(struct gen_s *gen, const char *name, char *path)
+{
+    FILE *fp;
+
+    snprintf(path, BUF_SIZE, "%s/%s", gen->dir, name);
+    if (!(fp = fopen(path, "w")))
+        error("Cannot create file: %s\n", path);
+
+    return fp;
+}
+
+static void write_global(struct gen_s *gen)
+{
+    char path[BUF_SIZE], soil[BUF_SIZE], veglib[BUF_SIZE], vegparam[BUF_SIZE];
+    FILE *fp = create_file(gen, "global.txt", path);
+
+    snprintf(soil, BUF_SIZE, "%s/soil.txt", gen->dir);
+    snprintf(veglib, BUF_SIZE, "%s/veglib.txt", gen->dir);
+    snprintf(vegparam, BUF_SIZE, "%s/vegparam.txt", gen->dir);
+
+    fprintf(fp, "# synthetic dataset of %ld cells from classic_gen\n",
+            gen->n_cells);
+    fprintf(fp, "NLAYER %d\n", gen->nlayer);
+    fprintf(fp, "NODES 5\n");
+    fprintf(fp, "STARTYEAR 2000\nSTARTMONTH 1\nSTARTDAY 1\n");
+    fprintf(fp, "ENDYEAR 2000\nENDMONTH 12\nENDDAY 31\n");
+    /* the forcing is not generated, but populate_image_global_params()
+     * needs its types */
+    fprintf(fp, "FORCING1 %s/forcing/data_\n", gen->dir);
+    fprintf(fp, "FORCE_FORMAT ASCII\nFORCE_TYPE PREC\nFORCE_TYPE AIR_TEMP\n");
+    fprintf(fp, "FORCE_STEPS_PER_DAY 1\n");
+    fprintf(fp, "FORCEYEAR 2000\nFORCEMONTH 1\nFORCEDAY 1\n");
+    fprintf(fp, "GRID_DECIMAL 5\n");
+    fprintf(fp, "SOIL %s\n", soil);
+    fprintf(fp, "ORGANIC_FRACT %s\n", gen->organic_fract ? "TRUE" : "FALSE");
+    fprintf(fp, "SPATIAL_FROST %s\n", gen->spatial_frost ? "TRUE" : "FALSE");
+    fprintf(fp, "JULY_TAVG_SUPPLIED %s\n",
+            gen->july_tavg_supplied ? "TRUE" : "FALSE");
+    fprintf(fp, "BLOWING %s\n", gen->blowing ? "TRUE" : "FALSE");
+    fprintf(fp, "VEGLIB %s\n", veglib);
+    fprintf(fp, "VEGLIB_FCAN %s\n", gen->veglib_fcan ? "TRUE" : "FALSE");
+    fprintf(fp, "VEGLIB_PHOTO %s\n", gen->veglib_photo ? "TRUE" : "FALSE");
+    fprintf(fp, "VEGPARAM %s\n", vegparam);
+    fprintf(fp, "ROOT_ZONES %d\n", gen->root_zones);
+    fprintf(fp, "VEGPARAM_LAI %s\n", gen->vegparam_lai ? "TRUE" : "FALSE");
+    fprintf(fp, "VEGPARAM_FCAN %s\n", gen->vegparam_fcan ? "TRUE" : "FALSE");
+    fprintf(fp, "VEGPARAM_ALB %s\n", gen->vegparam_alb ? "TRUE" : "FALSE");
+    fprintf(fp, "SNOW_BAND 1\n");
+
+    fclose(fp);
+}
+
+/* one line per cell in the column order of read_soil_cell() */
+static void write_soil(struct gen_s *gen)
+{
+    char path[BUF_SIZE];
+    FILE *fp = create_file(gen, "soil.txt", path);
+    int nl = gen->nlayer;
+    long k;
+
+    for (k = 0; k < gen->n_cells; k++) {
+        char *p = gen->line;
+
+        p += sprintf(p, "%d %ld %.5f %.5f", rand() % 10 != 0, k + 1,
+                     (k / gen->nlon - gen->nlat / 2.0 + 0.5) * RESOLUTION,
+                     (k % gen->nlon - gen->nlon / 2.0 + 0.5) * RESOLUTION);
+        /* infilt, Ds, Dsmax, Ws, c, expt, Ksat, phi_s, init_moist */
+        p = put_values(p, 5 + 4 * nl);
+        /* elev, depth, avg_T, dp, bubble, quartz, bulk_dens, soil_dens */
+        p = put_values(p, 1 + nl + 2 + 4 * nl);
+        if (gen->organic_fract)
+            p = put_values(p, 3 * nl);
+        /* off_gmt, Wcr_FRACT, Wpwp_FRACT, rough, snow_rough, annual_prec,
+         * resid_moist */
+        p = put_values(p, 1 + 2 * nl + 3 + nl);
+        p += sprintf(p, " %d", rand() % 2);
+        if (gen->spatial_frost)
+            p = put_values(p, 2);
+        if (gen->july_tavg_supplied)
+            p = put_values(p, 1);
+        strcpy(p, "\n");
+        fputs(gen->line, fp);
+    }
+
+    if (fclose(fp))
+        error("Cannot write file: %s\n", path);
+}
+
+static void write_veg_lib(struct gen_s *gen)
+{
+    char path[BUF_SIZE];
+    FILE *fp = create_file(gen, "veglib.txt", path);
+    int i;
+
+    fprintf(fp, "#Class OvrStry Rarc Rmin LAI ... comment\n");
+    for (i = 1; i <= N_CLASSES; i++) {
+        char *p = gen->line;
+
+        p += sprintf(p, "%d %d", i, rand() % 2);
+        /* rarc, rmin, LAI */
+        p = put_values(p, 2 + N_MONTHS);
+        if (gen->veglib_fcan)
+            p = put_values(p, N_MONTHS);
+        /* albedo, veg_rough, displacement, wind_h, RGL, rad_atten,
+         * wind_atten, trunk_ratio */
+        p = put_values(p, 3 * N_MONTHS + 5);
+        if (gen->veglib_photo) {
+            p += sprintf(p, " %d", rand() % 2);
+            p = put_values(p, 3);
+            p += sprintf(p, " %d", rand() % 2);
+            p = put_values(p, 2);
+        }
+        sprintf(p, " class %d\n", i);
+        fputs(gen->line, fp);
+    }
+
+    fclose(fp);
+}
+
+/* nveg tiles of distinct classes per cell, with equal Cv */
+static void write_veg_params(struct gen_s *gen)
+{
+    char path[BUF_SIZE];
+    FILE *fp = create_file(gen, "vegparam.txt", path);
+    int classes[N_CLASSES];
+    long k;
+    int i, j;
+
+    for (i = 0; i < N_CLASSES; i++)
+        classes[i] = i + 1;
+
+    for (k = 0; k < gen->n_cells; k++) {
+        fprintf(fp, "%ld %d\n", k + 1, gen->nveg);
+        for (i = 0; i < gen->nveg; i++) {
+            int t = classes[i];
+            char *p = gen->line;
+
+            /* partial shuffle for the class of tile i */
+            j = i + rand() % (N_CLASSES - i);
+            classes[i] = classes[j];
+            classes[j] = t;
+
+            p += sprintf(p, "   %d", classes[i]);
+            p = put_value(p, 10000 / gen->nveg);
+            /* root_depth and root_fract */
+            p = put_values(p, 2 * gen->root_zones);
+            /* sigma_slope, lag_one, fetch */
+            if (gen->blowing)
+                p = put_values(p, 3);
+            strcpy(p, "\n");
+            fputs(gen->line, fp);
+
+            for (j = gen->vegparam_lai + gen->vegparam_fcan +
+                 gen->vegparam_alb; j > 0; j--) {
+                p = gen->line + sprintf(gen->line, "     ");
+                p = put_values(p, N_MONTHS);
+                strcpy(p, "\n");
+                fputs(gen->line, fp);
+            }
+        }
+    }
+
+    if (fclose(fp))
+        error("Cannot write file: %s\n", path);
+}
+
+/* n random values from 0 to 10, each after a space */
+static char *put_values(char *p, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        p = put_value(p, rand() % 100000);
+
+    return p;
+}
+
+/* value / 10000 with 4 decimals after a space; faster than printf, which
+ * matters for millions of cells */
+static char *put_value(char *p, int value)
+{
+    char digits[12];
+    int n = 0;
+
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value || n < 5);
+
+    *p++ = ' ';
+    while (n > 4)
+        *p++ = digits[--n];
+    *p++ = '.';
+    while (n > 0)
+        *p++ = digits[--n];
+
+    return p;
+}
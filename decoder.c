@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "global.h"
+#include "decoder.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define X86_KERNELS
+#include <immintrin.h>
+#endif
+
+#define LANES 8
+
+static void decode_scalar(const struct decoder_s *, const unsigned short *,
+                          size_t, float *);
+static void decode_tail(const struct decoder_s *, const unsigned short *,
+                        size_t, float *, int);
+#ifdef X86_KERNELS
+static void decode_sse41(const struct decoder_s *, const unsigned short *,
+                         size_t, float *);
+static void decode_avx2(const struct decoder_s *, const unsigned short *,
+                        size_t, float *);
+#endif
+
+/* multipliers and signedness of each of n_types columns; swap if the
+ * records are not in our byte order */
+void init_decoder_s(struct decoder_s *decoder, int n_types,
+                    const double *multipliers, const int *is_signed,
+                    int swap)
+{
+    int i;
+
+    decoder->n_types = n_types;
+    decoder->swap = swap;
+    decoder->period = LANES * n_types;
+    decoder->divisors = malloc(sizeof *decoder->divisors * decoder->period);
+    decoder->float_divisors =
+        malloc(sizeof *decoder->float_divisors * decoder->period);
+    decoder->signs = malloc(sizeof *decoder->signs * decoder->period);
+    for (i = 0; i < decoder->period; i++) {
+        decoder->divisors[i] = multipliers[i % n_types];
+        decoder->float_divisors[i] = multipliers[i % n_types];
+        decoder->signs[i] = is_signed[i % n_types] ? -1 : 0;
+    }
+    for (i = 0; i < n_types; i++)
+        if (decoder->float_divisors[i] != decoder->divisors[i]) {
+            free(decoder->float_divisors);
+            decoder->float_divisors = NULL;
+            break;
+        }
+
+    if (!use_decoder_kernel(decoder, "avx2") &&
+        !use_decoder_kernel(decoder, "sse4.1"))
+        use_decoder_kernel(decoder, "scalar");
+}
+
+void free_decoder_s(struct decoder_s *decoder)
+{
+    free(decoder->divisors);
+    free(decoder->float_divisors);
+    free(decoder->signs);
+}
+
+/* use the named kernel, scalar, sse4.1 or avx2; return 0 if the CPU does
+ * not support it */
+int use_decoder_kernel(struct decoder_s *decoder, const char *kernel)
+{
+    if (strcmp(kernel, "scalar") == 0)
+        decoder->decode = decode_scalar;
+#ifdef X86_KERNELS
+    else if (strcmp(kernel, "sse4.1") == 0 &&
+             __builtin_cpu_supports("sse4.1"))
+        decoder->decode = decode_sse41;
+    else if (strcmp(kernel, "avx2") == 0 && __builtin_cpu_supports("avx2"))
+        decoder->decode = decode_avx2;
+#endif
+    else
+        return 0;
+
+    decoder->kernel = kernel;
+
+    return 1;
+}
+
+/* decode n_records records of raw into out */
+void decode_records(const struct decoder_s *decoder,
+                    const unsigned short *raw, size_t n_records, float *out)
+{
+    decoder->decode(decoder, raw, n_records * decoder->n_types, out);
+}
+
+static void decode_scalar(const struct decoder_s *decoder,
+                          const unsigned short *raw, size_t n, float *out)
+{
+    decode_tail(decoder, raw, n, out, 0);
+}
+
+/* decode n values starting at value p of a period */
+static void decode_tail(const struct decoder_s *decoder,
+                        const unsigned short *raw, size_t n, float *out,
+                        int p)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        unsigned short value = raw[i];
+
+        if (decoder->swap)
+            value = value >> 8 | value << 8;
+        out[i] = (decoder->signs[p] ? (short)value : value) /
+            decoder->divisors[p];
+        if (++p == decoder->period)
+            p = 0;
+    }
+}
+
+#ifdef X86_KERNELS
+/* the vector kernels give the same floats as decode_tail(): they divide in
+ * double precision, or in single precision if the multipliers are exact
+ * floats, which rounds the same because a 16-bit value is an exact float and
+ * a double has more than twice the precision of a float */
+
+__attribute__ ((target("sse4.1")))
+static void decode_sse41(const struct decoder_s *decoder,
+                         const unsigned short *raw, size_t n, float *out)
+{
+    const __m128i swap =
+        _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    const double *divisors = decoder->divisors;
+    const float *float_divisors = decoder->float_divisors;
+    const int *signs = decoder->signs;
+    size_t i;
+    int p = 0;
+
+    for (i = 0; i + LANES <= n; i += LANES) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(raw + i)), high, a, b;
+        __m128d d0, d1, d2, d3;
+
+        if (decoder->swap)
+            v = _mm_shuffle_epi8(v, swap);
+        high = _mm_srli_si128(v, 8);
+        a = _mm_blendv_epi8(_mm_cvtepu16_epi32(v), _mm_cvtepi16_epi32(v),
+                            _mm_loadu_si128((const __m128i *)(signs + p)));
+        b = _mm_blendv_epi8(_mm_cvtepu16_epi32(high),
+                            _mm_cvtepi16_epi32(high),
+                            _mm_loadu_si128((const __m128i *)(signs + p +
+                                                              4)));
+        if (float_divisors) {
+            _mm_storeu_ps(out + i, _mm_div_ps(_mm_cvtepi32_ps(a),
+                                              _mm_loadu_ps(float_divisors +
+                                                           p)));
+            _mm_storeu_ps(out + i + 4,
+                          _mm_div_ps(_mm_cvtepi32_ps(b),
+                                     _mm_loadu_ps(float_divisors + p + 4)));
+            if ((p += LANES) == decoder->period)
+                p = 0;
+            continue;
+        }
+        d0 = _mm_div_pd(_mm_cvtepi32_pd(a), _mm_loadu_pd(divisors + p));
+        d1 = _mm_div_pd(_mm_cvtepi32_pd(_mm_unpackhi_epi64(a, a)),
+                        _mm_loadu_pd(divisors + p + 2));
+        d2 = _mm_div_pd(_mm_cvtepi32_pd(b), _mm_loadu_pd(divisors + p + 4));
+        d3 = _mm_div_pd(_mm_cvtepi32_pd(_mm_unpackhi_epi64(b, b)),
+                        _mm_loadu_pd(divisors + p + 6));
+        _mm_storeu_ps(out + i, _mm_movelh_ps(_mm_cvtpd_ps(d0),
+                                             _mm_cvtpd_ps(d1)));
+        _mm_storeu_ps(out + i + 4, _mm_movelh_ps(_mm_cvtpd_ps(d2),
+                                                 _mm_cvtpd_ps(d3)));
+        if ((p += LANES) == decoder->period)
+            p = 0;
+    }
+
+    decode_tail(decoder, raw + i, n - i, out + i, p);
+}
+
+__attribute__ ((target("avx2")))
+static void decode_avx2(const struct decoder_s *decoder,
+                        const unsigned short *raw, size_t n, float *out)
+{
+    const __m128i swap =
+        _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+    const double *divisors = decoder->divisors;
+    const float *float_divisors = decoder->float_divisors;
+    const int *signs = decoder->signs;
+    size_t i;
+    int p = 0;
+
+    for (i = 0; i + LANES <= n; i += LANES) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(raw + i));
+        __m256i x;
+        __m256d low, high;
+
+        if (decoder->swap)
+            v = _mm_shuffle_epi8(v, swap);
+        x = _mm256_blendv_epi8(_mm256_cvtepu16_epi32(v),
+                               _mm256_cvtepi16_epi32(v),
+                               _mm256_loadu_si256((const __m256i *)(signs +
+                                                                    p)));
+        if (float_divisors) {
+            _mm256_storeu_ps(out + i,
+                             _mm256_div_ps(_mm256_cvtepi32_ps(x),
+                                           _mm256_loadu_ps(float_divisors +
+                                                           p)));
+            if ((p += LANES) == decoder->period)
+                p = 0;
+            continue;
+        }
+        low = _mm256_div_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(x)),
+                            _mm256_loadu_pd(divisors + p));
+        high = _mm256_div_pd(_mm256_cvtepi32_pd
+                             (_mm256_extracti128_si256(x, 1)),
+                             _mm256_loadu_pd(divisors + p + 4));
+        _mm_storeu_ps(out + i, _mm256_cvtpd_ps(low));
+        _mm_storeu_ps(out + i + 4, _mm256_cvtpd_ps(high));
+        if ((p += LANES) == decoder->period)
+            p = 0;
+    }
+
+    decode_tail(decoder, raw + i, n - i, out + i, p);
+}
+#endif
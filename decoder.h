@@ -0,0 +1,24 @@
+/* decoder of classic binary forcing records of n_types 16-bit integers into
+ * floats, each divided by the multiplier of its column; the kernel is
+ * chosen at run time from what the CPU supports */
+struct decoder_s
+{
+    int n_types;
+    int swap;                   /* byte order differs from ours */
+    int period;                 /* values after which the columns of 8-value
+                                 * vectors repeat */
+    double *divisors;           /* multiplier of each value of a period */
+    float *float_divisors;      /* the same if all are exact floats */
+    int *signs;                 /* -1 if it is signed, else 0 */
+    const char *kernel;
+    void (*decode)(const struct decoder_s *, const unsigned short *, size_t,
+                   float *);
+};
+
+/* decoder.c */
+void init_decoder_s(struct decoder_s *, int, const double *, const int *,
+                    int);
+void free_decoder_s(struct decoder_s *);
+int use_decoder_kernel(struct decoder_s *, const char *);
+void decode_records(const struct decoder_s *, const unsigned short *, size_t,
+                    float *);
@@ -1,8 +1,13 @@
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <math.h>
 #include "global.h"
 #include "double_stack.h"
 
+static unsigned int hash_double(double);
+static void grow_double_hash(struct double_stack_s *, struct double_hash_s *);
+
 void init_double_stack_s(struct double_stack_s *stack)
 {
     stack->nalloc = stack->n = 0;
@@ -62,3 +67,94 @@ int compare_doubles(const void *p1, const void *p2)
 
     return (value1 > value2) - (value1 < value2);
 }
+
+void init_double_hash_s(struct double_hash_s *hash)
+{
+    hash->nalloc = 0;
+    hash->slots = NULL;
+}
+
+void free_double_hash_s(struct double_hash_s *hash)
+{
+    if (hash->slots)
+        free(hash->slots);
+    init_double_hash_s(hash);
+}
+
+/* push value unless it is already in the stack and return its index; every
+ * value in the stack must have been pushed through the same hash */
+int push_unique_double(struct double_stack_s *stack,
+                       struct double_hash_s *hash, double value)
+{
+    unsigned int mask, i;
+
+    if ((stack->n + 1) * 2 > hash->nalloc)
+        grow_double_hash(stack, hash);
+
+    mask = hash->nalloc - 1;
+    for (i = hash_double(value) & mask; hash->slots[i] >= 0;
+         i = (i + 1) & mask)
+        if (stack->values[hash->slots[i]] == value)
+            return hash->slots[i];
+
+    hash->slots[i] = stack->n;
+    push_double(stack, value);
+
+    return hash->slots[i];
+}
+
+/* binary search in a stack sorted by compare_doubles */
+int search_double(struct double_stack_s *stack, double value)
+{
+    int lo = 0, hi = stack->n - 1;
+
+    while (lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+
+        if (stack->values[mid] < value)
+            lo = mid + 1;
+        else if (stack->values[mid] > value)
+            hi = mid - 1;
+        else
+            return mid;
+    }
+
+    return -1;
+}
+
+static unsigned int hash_double(double value)
+{
+    uint64_t bits;
+
+    /* -0 == 0, so both have to land in the same slot */
+    if (value == 0)
+        value = 0;
+
+    memcpy(&bits, &value, sizeof bits);
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdULL;
+    bits ^= bits >> 33;
+
+    return (unsigned int)bits;
+}
+
+static void grow_double_hash(struct double_stack_s *stack,
+                             struct double_hash_s *hash)
+{
+    unsigned int mask;
+    int i;
+
+    hash->nalloc = hash->nalloc ? hash->nalloc * 2 : REALLOC_INCREMENT;
+    hash->slots = realloc(hash->slots, sizeof *hash->slots * hash->nalloc);
+    for (i = 0; i < hash->nalloc; i++)
+        hash->slots[i] = -1;
+
+    mask = hash->nalloc - 1;
+    for (i = 0; i < stack->n; i++) {
+        unsigned int j;
+
+        for (j = hash_double(stack->values[i]) & mask; hash->slots[j] >= 0;
+             j = (j + 1) & mask) ;
+        hash->slots[j] = i;
+    }
+}
@@ -5,6 +5,13 @@ struct double_stack_s
     int nalloc;
 };
 
+/* open-addressing index into the values of a double_stack_s */
+struct double_hash_s
+{
+    int *slots;                 /* index into values; -1 for empty */
+    int nalloc;                 /* power of two */
+};
+
 /* double_stack.c */
 void init_double_stack_s(struct double_stack_s *);
 void free_double_stack_s(struct double_stack_s *);
@@ -12,3 +19,8 @@ void push_double(struct double_stack_s *, double);
 double pop_double(struct double_stack_s *);
 int find_double(struct double_stack_s *, double);
 int compare_doubles(const void *, const void *);
+void init_double_hash_s(struct double_hash_s *);
+void free_double_hash_s(struct double_hash_s *);
+int push_unique_double(struct double_stack_s *, struct double_hash_s *,
+                       double);
+int search_double(struct double_stack_s *, double);
@@ -4,8 +4,11 @@
 #define REALLOC_INCREMENT 1024
 #define BUF_SIZE 2048
 
+/* the files are read on several threads; the first thread to fail keeps
+ * stderr locked until it exits, so others block instead of exiting too */
 #define error(format, ...) \
     do { \
+        flockfile(stderr); \
         fprintf(stderr, format, ##__VA_ARGS__); \
         exit(EXIT_FAILURE); \
     } while(0)
@@ -1,11 +1,15 @@
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <unistd.h>
 #include "vic.h"
 
 #define DOMAIN "domain.nc"
 #define PARAMETERS "params.nc"
+#define FORCING "forcing"
+#define STATE "state"
 
 static int read_int(const char *);
 static float read_float(const char *);
@@ -311,6 +315,12 @@ struct global_params_s *read_global_params(char *global_path)
                         gp->n_outfiles * sizeof *gp->n_outvars);
             gp->outvar =
                 realloc(gp->outvar, gp->n_outfiles * sizeof *gp->outvar);
+            gp->aggfreq[outfile] = NULL;
+            gp->histfreq[outfile] = NULL;
+            gp->compress[outfile] = 0;
+            gp->out_format[outfile] = ASCII;
+            gp->n_outvars[outfile] = 0;
+            gp->outvar[outfile] = NULL;
         }
         else if (strcasecmp(key, "AGGFREQ") == 0) {
             int outfile = gp->n_outfiles - 1;
@@ -373,9 +383,13 @@ void free_global_params(struct global_params_s *gp)
 
     free(gp->init_state);
     free(gp->statename);
+    free(gp->image_state);
 
     free(gp->forcing1);
     free(gp->forcing2);
+    free(gp->image_forcing[0]);
+    free(gp->image_forcing[1]);
+    free(gp->image_history);
     for (i = 0; i < 2; i++) {
         for (j = 0; j < gp->n_types[i]; j++) {
             free(gp->force_type[i][j]->nc_name);
@@ -553,6 +567,29 @@ void populate_image_global_params(struct global_params_s *gp,
         strcpy(gp->domain_type[i]->nc_name, p);
     }
 
+    /* yearly forcing files are named image_prefix + forcing1_YYYY.nc */
+    for (i = 0; i < 2; i++) {
+        const char *prefix = image_prefix ? image_prefix : "";
+
+        if (!(i ? gp->forcing2 : gp->forcing1))
+            continue;
+
+        gp->image_forcing[i] = malloc(strlen(prefix) + strlen(FORCING) + 3);
+        sprintf(gp->image_forcing[i], "%s%s%d_", prefix, FORCING, i + 1);
+    }
+
+    /* history files are named image_prefix + outfile.YYYY-MM-DD.nc */
+    gp->image_history = malloc(strlen(image_prefix ? image_prefix : "") + 1);
+    strcpy(gp->image_history, image_prefix ? image_prefix : "");
+
+    /* the state file is named image_prefix + state.YYYYMMDD_SSSSS.nc */
+    if (gp->init_state) {
+        const char *prefix = image_prefix ? image_prefix : "";
+
+        gp->image_state = malloc(strlen(prefix) + strlen(STATE) + 1);
+        sprintf(gp->image_state, "%s%s", prefix, STATE);
+    }
+
     if (image_prefix) {
         gp->parameters =
             malloc(strlen(image_prefix) + strlen(PARAMETERS) + 1);
@@ -837,9 +874,9 @@ static struct force_type_s *read_force_type(const char *buf)
         ret->multiplier = 1;
     }
     else if (sscanf(buf, "%*s %*s %s %lf", str, &ret->multiplier) == 2) {
-        if (strcasecmp(str, "SIGNED"))
+        if (strcasecmp(str, "SIGNED") == 0)
             ret->is_signed = true;
-        else if (strcasecmp(str, "UNSIGNED"))
+        else if (strcasecmp(str, "UNSIGNED") == 0)
             ret->is_signed = false;
         else
             error("Invalid SIGNED/UNSIGNED: %s\n", str);
@@ -998,18 +1035,79 @@ static struct freq_s *read_freq(const char *buf)
 
 static int read_compress(const char *buf)
 {
-    int ret;
     char str[BUF_SIZE];
 
     if (sscanf(buf, "%*s %s", str) != 1)
         error("Invalid COMPRESS: %s\n", buf);
 
+    return read_compress_level(str);
+}
+
+/* read a byte count of at least 1 with an optional K, M or G suffix */
+size_t read_size(const char *buf)
+{
+    double size;
+    char *end;
+
+    size = strtod(buf, &end);
+    if (end == buf)
+        error("Invalid size: %s\n", buf);
+
+    switch (*end) {
+    case 0:
+        break;
+    case 'k':
+    case 'K':
+        size *= 1024;
+        end++;
+        break;
+    case 'm':
+    case 'M':
+        size *= 1024 * 1024;
+        end++;
+        break;
+    case 'g':
+    case 'G':
+        size *= 1024 * 1024 * 1024;
+        end++;
+        break;
+    default:
+        error("Invalid size: %s\n", buf);
+    }
+
+    /* also rejects nan; SIZE_MAX rounds up to a power of two as a double */
+    if (*end || !(size >= 1) || size >= (double)SIZE_MAX)
+        error("Invalid size: %s\n", buf);
+
+    return size;
+}
+
+/* read a thread count; 0 means one per online processor */
+int read_threads(const char *buf)
+{
+    int threads;
+    char c;
+
+    if (sscanf(buf, "%d%c", &threads, &c) != 1 || threads < 0)
+        error("Invalid number of threads: %s\n", buf);
+
+    if (!threads && (threads = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+        threads = 1;
+
+    return threads;
+}
+
+/* TRUE, FALSE or a deflate level from 1 to 9 as in COMPRESS */
+int read_compress_level(const char *str)
+{
+    int ret;
+
     if (strcasecmp(str, "TRUE") == 0)
         ret = 1;
     else if (strcasecmp(str, "FALSE") == 0)
         ret = 0;
-    else if (sscanf(buf, "%*s %d", &ret) != 1 || ret < 1 || ret > 9)
-        error("Invalid COMPRESS: %s\n", buf);
+    else if (sscanf(str, "%d", &ret) != 1 || ret < 1 || ret > 9)
+        error("Invalid COMPRESS: %s\n", str);
 
     return ret;
 }
@@ -0,0 +1,59 @@
+#include <stdlib.h>
+#include "global.h"
+#include "gridcel_index.h"
+
+static unsigned int hash_gridcel(int);
+
+/* index the n gridcels, which must outlive the index */
+void init_gridcel_index_s(struct gridcel_index_s *index, const int *gridcels,
+                          int n)
+{
+    unsigned int mask;
+    int i;
+
+    index->gridcels = gridcels;
+
+    /* keep the load factor at or below 1/2 */
+    index->nalloc = REALLOC_INCREMENT;
+    while (index->nalloc < n * 2)
+        index->nalloc *= 2;
+
+    index->slots = malloc(sizeof *index->slots * index->nalloc);
+    for (i = 0; i < index->nalloc; i++)
+        index->slots[i] = -1;
+
+    mask = index->nalloc - 1;
+    for (i = 0; i < n; i++) {
+        unsigned int j;
+
+        /* the first row wins as in a linear scan */
+        for (j = hash_gridcel(gridcels[i]) & mask;
+             index->slots[j] >= 0 && gridcels[index->slots[j]] != gridcels[i];
+             j = (j + 1) & mask) ;
+        if (index->slots[j] < 0)
+            index->slots[j] = i;
+    }
+}
+
+void free_gridcel_index_s(struct gridcel_index_s *index)
+{
+    free(index->slots);
+}
+
+/* return the first row with gridcel or -1 */
+int find_gridcel(const struct gridcel_index_s *index, int gridcel)
+{
+    unsigned int mask = index->nalloc - 1, i;
+
+    for (i = hash_gridcel(gridcel) & mask; index->slots[i] >= 0;
+         i = (i + 1) & mask)
+        if (index->gridcels[index->slots[i]] == gridcel)
+            return index->slots[i];
+
+    return -1;
+}
+
+static unsigned int hash_gridcel(int gridcel)
+{
+    return (unsigned int)gridcel * 2654435761U;
+}
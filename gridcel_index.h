@@ -0,0 +1,13 @@
+/* open-addressing index of the first of n rows with each gridcel, for
+ * gridcel lookups in O(1) */
+struct gridcel_index_s
+{
+    const int *gridcels;        /* gridcel of each row; not owned */
+    int nalloc;                 /* power of two */
+    int *slots;                 /* row; -1 for empty */
+};
+
+/* gridcel_index.c */
+void init_gridcel_index_s(struct gridcel_index_s *, const int *, int);
+void free_gridcel_index_s(struct gridcel_index_s *);
+int find_gridcel(const struct gridcel_index_s *, int);
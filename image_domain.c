@@ -12,8 +12,11 @@ void create_image_domain(struct global_params_s *gp, struct domain_s *domain)
     int ncid, dimids[LON + 1], varids[XDIM + 1];
     char *lat = NULL, *lon = NULL, *varnames[XDIM + 1];
 
-    nc_check(nc_create(gp->domain, NC_CLOBBER, &ncid),
-             "Cannot create file: %s\n", gp->domain);
+    /* at most one [lat][lon] double per domain variable */
+    nc_check(nc_create(gp->domain,
+                       image_create_mode(gp, sizeof(double) * (XDIM + 1) *
+                                         domain->lat->n * domain->lon->n),
+                       &ncid), "Cannot create file: %s\n", gp->domain);
 
     /* dimensions */
     for (i = 0; i < gp->n_domain_types; i++) {
@@ -105,6 +108,8 @@ void create_image_domain(struct global_params_s *gp, struct domain_s *domain)
         }
     }
 
+    chunk_image_vars(gp, ncid, dimids[0], dimids[1]);
+
     nc_check(nc_enddef(ncid), "Cannot end definition\n");
 
     /* populate variables */
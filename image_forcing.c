@@ -0,0 +1,845 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <netcdf.h>
+#include "global.h"
+#include "arena.h"
+#include "double_stack.h"
+#include "decoder.h"
+#include "line_reader.h"
+#include "parser.h"
+#include "vic.h"
+#include "stats.h"
+
+#define SECONDS_PER_DAY 86400
+
+/* one set of classic forcing files, FORCING1 or FORCING2 */
+struct forcing_s
+{
+    struct global_params_s *gp;
+    struct soil_s *soil;
+    const char *prefix;         /* classic file of a cell: prefix_lat_lon */
+    const char *image_prefix;   /* image file of a year: prefixYYYY.nc */
+    struct force_type_s **types;
+    int n_types;                /* values per record */
+    int n_vars;                 /* types other than SKIP */
+    int *var_columns;           /* column of each variable in a record */
+    int *column_vars;           /* variable of each column; -1 if SKIP */
+    long step;                  /* seconds per record */
+    long long start, end;       /* simulation period in seconds */
+    long skip;                  /* records before the simulation start */
+    long *offsets;              /* ASCII: next record of each cell */
+    struct decoder_s decoder;   /* binary */
+    int n_readers;
+    struct forcing_reader_s *readers;
+    pthread_t *threads;
+    /* the block of cells being read; the readers take its rows in turn */
+    struct year_s *year;
+    float *block;
+    int block_first, block_n;
+    int next_row;
+    pthread_mutex_t lock;
+    double read_seconds;
+};
+
+/* one of the I/O threads reading the files of a block of cells */
+struct forcing_reader_s
+{
+    struct forcing_s *f;
+    unsigned short *raw;        /* binary: records of one cell */
+    float *decoded;             /* binary: the same, decoded if some are
+                                 * skipped */
+    long files;
+    long long bytes;
+};
+
+/* the lat_lon file name suffix of an active cell */
+struct cell_file_s
+{
+    char *name;
+    int cell;
+    int found;
+};
+
+/* the records of one year are transposed in blocks: the first pass reads
+ * block_cells cells at a time and the second one writes block_steps steps
+ * at a time; in between, the buffer and the scratch file hold
+ * [step block][cell][step][var], so each block is contiguous */
+struct year_s
+{
+    int year;
+    long first;                 /* first record of the year */
+    int n_steps;
+    int block_steps;            /* the last block may be shorter */
+    int block_cells;
+    double *times;              /* days since the start of the year */
+};
+
+static void convert_forcing(struct global_params_s *, struct soil_s *, int);
+static void convert_year(struct forcing_s *, struct year_s *);
+static int compare_cell_files(const void *, const void *);
+static void read_block(struct forcing_s *, struct year_s *, float *, int,
+                       int);
+static void *read_cells(void *);
+static int take_row(struct forcing_s *);
+static void prefetch_cell(struct forcing_s *, int);
+static void read_cell(struct forcing_reader_s *, int);
+static void read_binary_cell(struct forcing_reader_s *, const char *, int);
+static void read_ascii_cell(struct forcing_reader_s *, int, const char *,
+                            int);
+static void cell_path(struct forcing_s *, int, char *);
+static float *record_at(struct forcing_s *, struct year_s *, float *, int,
+                        int, int);
+static void write_steps(struct forcing_s *, int, int, const float *,
+                        float *);
+static const char *force_units(enum force_type);
+static double elapsed(struct timespec *);
+
+/* convert the classic forcing files of the soil cells into yearly image
+ * forcing files, buffering at most about gp->max_memory bytes, or 1 GB if
+ * it is not set */
+void create_image_forcing(struct global_params_s *gp, struct soil_s *soil)
+{
+    int i;
+
+    for (i = 0; i < 2; i++)
+        if (gp->image_forcing[i])
+            convert_forcing(gp, soil, i);
+}
+
+static void convert_forcing(struct global_params_s *gp, struct soil_s *soil,
+                            int forcing)
+{
+    struct forcing_s f;
+    struct year_s y;
+    long long force_start, bytes = 0;
+    long files = 0;
+    int steps_per_day;
+    int i;
+
+    f.gp = gp;
+    f.soil = soil;
+    f.prefix = forcing ? gp->forcing2 : gp->forcing1;
+    f.image_prefix = gp->image_forcing[forcing];
+    f.types = gp->force_type ? gp->force_type[forcing] : NULL;
+    f.n_types = gp->n_types ? gp->n_types[forcing] : 0;
+
+    if (!gp->force_steps_per_day ||
+        (steps_per_day = gp->force_steps_per_day[forcing]) < 1 ||
+        SECONDS_PER_DAY % steps_per_day)
+        error("Invalid FORCE_STEPS_PER_DAY: %s\n", f.prefix);
+    f.step = SECONDS_PER_DAY / steps_per_day;
+
+    f.var_columns = malloc(sizeof *f.var_columns * f.n_types);
+    f.column_vars = malloc(sizeof *f.column_vars * f.n_types);
+    f.n_vars = 0;
+    for (i = 0; i < f.n_types; i++) {
+        if (f.types[i]->force_type == SKIP) {
+            f.column_vars[i] = -1;
+            continue;
+        }
+        if (gp->force_format == BINARY && !f.types[i]->multiplier)
+            error("FORCE_TYPE %s needs SIGNED or UNSIGNED and a multiplier "
+                  "for binary forcing: %s\n", f.types[i]->nc_name, f.prefix);
+        f.var_columns[f.n_vars] = i;
+        f.column_vars[i] = f.n_vars++;
+    }
+    if (!f.n_vars)
+        error("No FORCE_TYPE to convert: %s\n", f.prefix);
+
+    /* the simulation period in seconds since 0001-01-01 */
+    f.start = date_to_days(gp->calendar, gp->startyear, gp->startmonth,
+                           gp->startday) * (long long)SECONDS_PER_DAY +
+        gp->startsec;
+    if (gp->nrecs > 0) {
+        if (gp->model_steps_per_day < 1)
+            error("NRECS needs MODEL_STEPS_PER_DAY\n");
+        f.end = f.start + (long long)gp->nrecs * SECONDS_PER_DAY /
+            gp->model_steps_per_day;
+    }
+    else
+        f.end = date_to_days(gp->calendar, gp->endyear, gp->endmonth,
+                             gp->endday + 1) * (long long)SECONDS_PER_DAY;
+    if (f.end <= f.start)
+        error("Simulation ends before it starts\n");
+
+    /* forcing files start at the simulation unless FORCEYEAR is set */
+    force_start = f.start;
+    if (gp->forceyear && gp->forceyear[forcing])
+        force_start = date_to_days(gp->calendar, gp->forceyear[forcing],
+                                   gp->forcemonth ? gp->forcemonth[forcing] :
+                                   1, gp->forceday ? gp->forceday[forcing] :
+                                   1) * (long long)SECONDS_PER_DAY +
+            (gp->forcesec ? gp->forcesec[forcing] : 0);
+    if (f.start < force_start || (f.start - force_start) % f.step)
+        error("Simulation start is not a forcing record: %s\n", f.prefix);
+    f.skip = (f.start - force_start) / f.step;
+
+    f.offsets = calloc(soil->n_cells, sizeof *f.offsets);
+    if (gp->force_format == BINARY) {
+        const unsigned short one = 1;
+        int little = *(const unsigned char *)&one;
+        double *multipliers = malloc(sizeof *multipliers * f.n_types);
+        int *is_signed = malloc(sizeof *is_signed * f.n_types);
+
+        /* skipped values are decoded but not kept */
+        for (i = 0; i < f.n_types; i++) {
+            multipliers[i] = f.types[i]->force_type == SKIP ? 1 :
+                f.types[i]->multiplier;
+            is_signed[i] = f.types[i]->is_signed;
+        }
+        init_decoder_s(&f.decoder, f.n_types, multipliers, is_signed,
+                       little != (gp->force_endian == LITTLE));
+
+        free(multipliers);
+        free(is_signed);
+    }
+
+    list_cell_files(gp, soil, f.prefix, "", "forcing");
+
+    /* each reader hints its next file to the kernel while it reads one, so
+     * the readers together keep several files in flight */
+    f.n_readers = gp->io_threads > 1 ? gp->io_threads : 1;
+    f.readers = malloc(sizeof *f.readers * f.n_readers);
+    f.threads = malloc(sizeof *f.threads * f.n_readers);
+    for (i = 0; i < f.n_readers; i++) {
+        f.readers[i].f = &f;
+        f.readers[i].raw = NULL;
+        f.readers[i].decoded = NULL;
+        f.readers[i].files = 0;
+        f.readers[i].bytes = 0;
+    }
+    pthread_mutex_init(&f.lock, NULL);
+    f.read_seconds = 0;
+
+    /* yearly files; the first and last ones may be partial */
+    for (y.year = gp->startyear;; y.year++) {
+        long long year_start =
+            date_to_days(gp->calendar, y.year, 1,
+                         1) * (long long)SECONDS_PER_DAY;
+        long long year_end =
+            date_to_days(gp->calendar, y.year + 1, 1,
+                         1) * (long long)SECONDS_PER_DAY;
+        long long lo = year_start > f.start ? year_start : f.start;
+        long long hi = year_end < f.end ? year_end : f.end;
+        long last;
+        int t;
+
+        if (lo >= hi)
+            break;
+
+        y.first = (lo - f.start + f.step - 1) / f.step;
+        last = (hi - f.start + f.step - 1) / f.step;
+        if (!(y.n_steps = last - y.first))
+            continue;
+
+        y.times = malloc(sizeof *y.times * y.n_steps);
+        for (t = 0; t < y.n_steps; t++)
+            y.times[t] = (double)(f.start + (y.first + t) * f.step -
+                                  year_start) / SECONDS_PER_DAY;
+
+        convert_year(&f, &y);
+
+        free(y.times);
+    }
+
+    free(f.var_columns);
+    free(f.column_vars);
+    free(f.offsets);
+    for (i = 0; i < f.n_readers; i++) {
+        files += f.readers[i].files;
+        bytes += f.readers[i].bytes;
+        free(f.readers[i].raw);
+        free(f.readers[i].decoded);
+    }
+    fprintf(stderr, "Read %ld forcing files (%.1f MB) in %.3f s, %.0f "
+            "files/s, %.1f MB/s: %s\n", files, bytes / 1e6, f.read_seconds,
+            f.read_seconds > 0 ? files / f.read_seconds : 0,
+            f.read_seconds > 0 ? bytes / 1e6 / f.read_seconds : 0, f.prefix);
+    add_stats_seconds(gp->stats, "forcing.read", f.read_seconds, files,
+                      bytes);
+    free(f.readers);
+    free(f.threads);
+    pthread_mutex_destroy(&f.lock);
+    if (gp->force_format == BINARY)
+        free_decoder_s(&f.decoder);
+}
+
+static void convert_year(struct forcing_s *f, struct year_s *y)
+{
+    struct global_params_s *gp = f->gp;
+    struct soil_s *soil = f->soil;
+    struct domain_s *domain = soil->domain;
+    int n_cells = soil->n_cells;
+    size_t ngrid = (size_t)domain->lat->n * domain->lon->n;
+    size_t record_bytes = sizeof(float) * f->n_vars;
+    size_t block_size;
+    char path[BUF_SIZE], scratch_path[BUF_SIZE], units[BUF_SIZE];
+    const char *calendar = calendar_name(gp->calendar);
+    int ncid, dimids[3], time_varid, lat_varid, lon_varid, *varids;
+    float *buf, *slab;
+    int scratch = -1;
+    int i, c, b, n_blocks;
+
+    /* the second pass buffers block_steps records of every cell and one
+     * [step][lat][lon] slab; the first pass block_cells cells */
+    transpose_blocks(gp, n_cells, y->n_steps, record_bytes,
+                     sizeof(float) * ngrid, &y->block_cells, &y->block_steps);
+    n_blocks = (y->n_steps + y->block_steps - 1) / y->block_steps;
+
+    if (snprintf(path, BUF_SIZE, "%s%d.nc", f->image_prefix, y->year) >=
+        BUF_SIZE)
+        error("Path too long: %s\n", f->image_prefix);
+
+    nc_check(nc_create(path, NC_CLOBBER | NC_64BIT_OFFSET, &ncid),
+             "Cannot create file: %s\n", path);
+
+    nc_check(nc_def_dim(ncid, "time", NC_UNLIMITED, &dimids[0]),
+             "Cannot define dimension: %s\n", "time");
+    nc_check(nc_def_dim(ncid, "lat", domain->lat->n, &dimids[1]),
+             "Cannot define dimension: %s\n", "lat");
+    nc_check(nc_def_dim(ncid, "lon", domain->lon->n, &dimids[2]),
+             "Cannot define dimension: %s\n", "lon");
+
+    nc_check(nc_def_var(ncid, "time", NC_DOUBLE, 1, dimids, &time_varid),
+             "Cannot define variable: %s\n", "time");
+    sprintf(units, "days since %04d-01-01 00:00:00", y->year);
+    nc_check(nc_put_att_text(ncid, time_varid, "units", strlen(units),
+                             units), "Cannot put attribute: %s\n", "time");
+    nc_check(nc_put_att_text(ncid, time_varid, "calendar", strlen(calendar),
+                             calendar), "Cannot put attribute: %s\n",
+             "time");
+    nc_check(nc_def_var(ncid, "lat", NC_DOUBLE, 1, dimids + 1, &lat_varid),
+             "Cannot define variable: %s\n", "lat");
+    nc_check(nc_def_var(ncid, "lon", NC_DOUBLE, 1, dimids + 2, &lon_varid),
+             "Cannot define variable: %s\n", "lon");
+
+    varids = malloc(sizeof *varids * f->n_vars);
+    for (i = 0; i < f->n_vars; i++) {
+        struct force_type_s *type = f->types[f->var_columns[i]];
+        const char *var_units = force_units(type->force_type);
+
+        nc_check(nc_def_var(ncid, type->nc_name, NC_FLOAT, 3, dimids,
+                            &varids[i]), "Cannot define variable: %s\n",
+                 type->nc_name);
+        nc_check(nc_put_att_text(ncid, varids[i], "units", strlen(var_units),
+                                 var_units), "Cannot put attribute: %s\n",
+                 type->nc_name);
+    }
+
+    nc_check(nc_enddef(ncid), "Cannot end definition\n");
+
+    {
+        size_t start = 0, count = y->n_steps;
+
+        nc_check(nc_put_vara_double(ncid, time_varid, &start, &count,
+                                    y->times), "Cannot put variable: %s\n",
+                 "time");
+    }
+    nc_check(nc_put_var_double(ncid, lat_varid, domain->lat->values),
+             "Cannot put variable: %s\n", "lat");
+    nc_check(nc_put_var_double(ncid, lon_varid, domain->lon->values),
+             "Cannot put variable: %s\n", "lon");
+
+    /* first pass: read blocks of cells and spill them to the scratch file
+     * unless all cells fit in one block */
+    block_size = (size_t)y->block_cells * y->n_steps * f->n_vars;
+    if (!(buf = malloc(sizeof *buf * block_size)))
+        error("Cannot allocate %zu bytes\n", sizeof *buf * block_size);
+
+    if (y->block_cells < n_cells) {
+        if (snprintf(scratch_path, BUF_SIZE, "%sscratch",
+                     f->image_prefix) >= BUF_SIZE)
+            error("Path too long: %s\n", f->image_prefix);
+        if ((scratch = open(scratch_path, O_RDWR | O_CREAT | O_TRUNC,
+                            0600)) < 0)
+            error("Cannot create file: %s\n", scratch_path);
+        /* removed as soon as it is closed, including by exiting */
+        unlink(scratch_path);
+    }
+
+    for (c = 0; c < n_cells; c += y->block_cells) {
+        int n = n_cells - c < y->block_cells ? n_cells - c : y->block_cells;
+
+        read_block(f, y, buf, c, n);
+
+        if (scratch < 0)
+            break;
+
+        for (b = 0; b < n_blocks; b++) {
+            int first = b * y->block_steps;
+            int steps = y->n_steps - first < y->block_steps ?
+                y->n_steps - first : y->block_steps;
+
+            write_scratch(scratch, record_at(f, y, buf, n, 0, first),
+                          record_bytes * n * steps,
+                          (off_t)record_bytes * ((size_t)first * n_cells +
+                                                 (size_t)c * steps),
+                          scratch_path);
+        }
+    }
+
+    /* second pass: read blocks of steps of all cells and write them */
+    if (scratch >= 0) {
+        free(buf);
+        if (!(buf = malloc(record_bytes * n_cells * y->block_steps)))
+            error("Cannot allocate %zu bytes\n",
+                  record_bytes * n_cells * y->block_steps);
+    }
+    if (!(slab = malloc(sizeof *slab * ngrid * y->block_steps)))
+        error("Cannot allocate %zu bytes\n",
+              sizeof *slab * ngrid * y->block_steps);
+
+    for (b = 0; b < n_blocks; b++) {
+        int first = b * y->block_steps;
+        int steps = y->n_steps - first < y->block_steps ?
+            y->n_steps - first : y->block_steps;
+        const float *block;
+
+        if (scratch >= 0) {
+            read_scratch(scratch, buf, record_bytes * n_cells * steps,
+                         (off_t)record_bytes * first * n_cells,
+                         scratch_path);
+            block = buf;
+        }
+        else
+            block = record_at(f, y, buf, n_cells, 0, first);
+
+        for (i = 0; i < f->n_vars; i++) {
+            size_t start[3] = { first, 0, 0 };
+            size_t count[3] = { steps, domain->lat->n, domain->lon->n };
+
+            write_steps(f, steps, i, block, slab);
+            nc_check(nc_put_vara_float(ncid, varids[i], start, count, slab),
+                     "Cannot put variable: %s\n",
+                     f->types[f->var_columns[i]]->nc_name);
+        }
+    }
+
+    if (scratch >= 0)
+        close(scratch);
+    free(buf);
+    free(slab);
+    free(varids);
+
+    nc_check(nc_close(ncid), "Cannot close file: %s\n", path);
+}
+
+/* match the files prefix_lat_lon plus ext of the active cells by listing
+ * the directory once rather than looking up each one, which is slow on
+ * parallel file systems, and report the missing ones before converting
+ * anything; kind names the files in the messages */
+void list_cell_files(struct global_params_s *gp, struct soil_s *soil,
+                     const char *prefix, const char *ext, const char *kind)
+{
+    const char *slash = strrchr(prefix, '/');
+    const char *base = slash ? slash + 1 : prefix;
+    size_t base_len = strlen(base);
+    char dir[BUF_SIZE], suffix[BUF_SIZE];
+    struct cell_file_s *files, key, *file;
+    struct arena_s arena;
+    struct dirent *entry;
+    struct timespec start;
+    DIR *dp;
+    int n = 0, n_found = 0, i;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (slash)
+        snprintf(dir, BUF_SIZE, "%.*s", (int)(slash - prefix + 1), prefix);
+    else
+        strcpy(dir, ".");
+
+    init_arena_s(&arena);
+    files = malloc(sizeof *files * soil->n_cells);
+    for (i = 0; i < soil->n_cells; i++) {
+        if (!is_active_cell(soil, i))
+            continue;
+        cell_file_suffix(gp, soil, i, suffix);
+        strcat(suffix, ext);
+        files[n].name = strcpy(arena_alloc(&arena, strlen(suffix) + 1),
+                               suffix);
+        files[n].cell = i;
+        files[n].found = 0;
+        n++;
+    }
+    qsort(files, n, sizeof *files, compare_cell_files);
+
+    if (!(dp = opendir(dir)))
+        error("Cannot open directory: %s\n", dir);
+    while ((entry = readdir(dp)))
+        if (strncmp(entry->d_name, base, base_len) == 0) {
+            key.name = entry->d_name + base_len;
+            if ((file = bsearch(&key, files, n, sizeof *files,
+                                compare_cell_files)) && !file->found) {
+                file->found = 1;
+                n_found++;
+            }
+        }
+    closedir(dp);
+
+    if (n_found < n)
+        for (i = 0; i < n; i++)
+            if (!files[i].found)
+                error("Cannot find file: %s%s\n", prefix, files[i].name);
+
+    fprintf(stderr, "Listed %d %s files in %.3f s: %s\n", n, kind,
+            elapsed(&start), dir);
+
+    free(files);
+    free_arena_s(&arena);
+}
+
+static int compare_cell_files(const void *a, const void *b)
+{
+    return strcmp(((const struct cell_file_s *)a)->name,
+                  ((const struct cell_file_s *)b)->name);
+}
+
+/* read the records of the year of cells c to c + n - 1 into buf with the
+ * reader pool */
+static void read_block(struct forcing_s *f, struct year_s *y, float *buf,
+                       int c, int n)
+{
+    int n_threads = f->n_readers < n ? f->n_readers : n;
+    struct timespec start;
+    int i;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    f->year = y;
+    f->block = buf;
+    f->block_first = c;
+    f->block_n = n;
+    f->next_row = 0;
+
+    if (n_threads <= 1)
+        read_cells(&f->readers[0]);
+    else {
+        for (i = 0; i < n_threads; i++)
+            if (pthread_create(&f->threads[i], NULL, read_cells,
+                               &f->readers[i]))
+                error("Cannot create thread\n");
+        for (i = 0; i < n_threads; i++)
+            pthread_join(f->threads[i], NULL);
+    }
+
+    f->read_seconds += elapsed(&start);
+}
+
+/* take rows until none is left, hinting the next file of this reader to
+ * the kernel before reading the current one */
+static void *read_cells(void *arg)
+{
+    struct forcing_reader_s *reader = arg;
+    int i = take_row(reader->f), next;
+
+    while (i >= 0) {
+        if ((next = take_row(reader->f)) >= 0)
+            prefetch_cell(reader->f, next);
+        read_cell(reader, i);
+        i = next;
+    }
+
+    return NULL;
+}
+
+/* next row of the block to read, or -1 */
+static int take_row(struct forcing_s *f)
+{
+    int i = -1;
+
+    pthread_mutex_lock(&f->lock);
+    if (f->next_row < f->block_n)
+        i = f->next_row++;
+    pthread_mutex_unlock(&f->lock);
+
+    return i;
+}
+
+/* start reading the records of the year of row i in the background; the
+ * file is opened and read later, when the data should be cached */
+static void prefetch_cell(struct forcing_s *f, int i)
+{
+    struct year_s *y = f->year;
+    int cell = f->block_first + i;
+    char path[BUF_SIZE];
+    off_t offset, size;
+    int fd;
+
+    if (!is_active_cell(f->soil, cell))
+        return;
+
+    cell_path(f, cell, path);
+    /* errors are reported when it is read */
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return;
+
+    /* ASCII records are about 8 characters per value */
+    if (f->gp->force_format == BINARY) {
+        offset = (off_t)sizeof(short) * f->n_types * (f->skip + y->first);
+        size = (off_t)sizeof(short) * f->n_types * y->n_steps;
+    }
+    else {
+        offset = f->offsets[cell];
+        size = (off_t)8 * f->n_types * ((y->first ? 0 : f->skip) +
+                                        y->n_steps);
+    }
+    posix_fadvise(fd, offset, size, POSIX_FADV_WILLNEED);
+
+    close(fd);
+}
+
+/* read the records of the year of row i of the block */
+static void read_cell(struct forcing_reader_s *reader, int i)
+{
+    struct forcing_s *f = reader->f;
+    struct year_s *y = f->year;
+    int cell = f->block_first + i;
+    char path[BUF_SIZE];
+    int t, j;
+
+    if (!is_active_cell(f->soil, cell)) {
+        for (t = 0; t < y->n_steps; t++) {
+            float *record = record_at(f, y, f->block, f->block_n, i, t);
+
+            for (j = 0; j < f->n_vars; j++)
+                record[j] = NC_FILL_FLOAT;
+        }
+        return;
+    }
+
+    cell_path(f, cell, path);
+
+    if (f->gp->force_format == BINARY)
+        read_binary_cell(reader, path, i);
+    else
+        read_ascii_cell(reader, cell, path, i);
+    reader->files++;
+}
+
+/* records of n_types 16-bit integers, each divided by its multiplier */
+static void read_binary_cell(struct forcing_reader_s *reader,
+                             const char *path, int i)
+{
+    struct forcing_s *f = reader->f;
+    struct year_s *y = f->year;
+    size_t size = sizeof *reader->raw * f->n_types * y->n_steps;
+    off_t offset =
+        (off_t)sizeof *reader->raw * f->n_types * (f->skip + y->first);
+    char *raw = (char *)reader->raw;
+    size_t done;
+    ssize_t count;
+    int fd, t, j;
+
+    /* no year is longer than 366 days */
+    if (!reader->raw) {
+        size_t max_values = (size_t)f->n_types * SECONDS_PER_DAY / f->step *
+            366;
+
+        raw = (char *)(reader->raw = malloc(sizeof *reader->raw *
+                                            max_values));
+        if (f->n_vars < f->n_types)
+            reader->decoded = malloc(sizeof *reader->decoded * max_values);
+    }
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        error("Cannot open file: %s\n", path);
+    for (done = 0; done < size; done += count)
+        if ((count = pread(fd, raw + done, size - done,
+                           offset + done)) <= 0)
+            error("Cannot read %ld records: %s\n",
+                  f->skip + y->first + y->n_steps, path);
+    close(fd);
+    reader->bytes += size;
+
+    /* the records of a block of steps are contiguous in the block */
+    if (f->n_vars == f->n_types) {
+        for (t = 0; t < y->n_steps; t += y->block_steps)
+            decode_records(&f->decoder, reader->raw + (size_t)t * f->n_types,
+                           y->n_steps - t < y->block_steps ?
+                           y->n_steps - t : y->block_steps,
+                           record_at(f, y, f->block, f->block_n, i, t));
+        return;
+    }
+
+    decode_records(&f->decoder, reader->raw, y->n_steps, reader->decoded);
+    for (t = 0; t < y->n_steps; t++) {
+        const float *decoded = reader->decoded + (size_t)t * f->n_types;
+        float *record = record_at(f, y, f->block, f->block_n, i, t);
+
+        for (j = 0; j < f->n_vars; j++)
+            record[j] = decoded[f->var_columns[j]];
+    }
+}
+
+/* one record of n_types values per line; the offset of the next record of
+ * each cell is kept for the next year */
+static void read_ascii_cell(struct forcing_reader_s *reader, int cell,
+                            const char *path, int i)
+{
+    struct forcing_s *f = reader->f;
+    struct year_s *y = f->year;
+    struct line_reader_s line_reader;
+    struct parser_s parser;
+    char *line;
+    long t;
+    int j;
+
+    open_line_reader(&line_reader, path);
+    init_parser_s(&parser, &line_reader);
+    seek_line(&line_reader, f->offsets[cell]);
+
+    /* records before the simulation start */
+    for (t = y->first ? 0 : -f->skip; t < y->n_steps; t++) {
+        float *record;
+
+        if (!(line = read_line(&line_reader)))
+            error("Cannot read %ld records: %s\n",
+                  f->skip + y->first + y->n_steps, path);
+        if (t < 0)
+            continue;
+
+        record = record_at(f, y, f->block, f->block_n, i, t);
+        parse_line(&parser, line);
+        for (j = 0; j < f->n_types; j++) {
+            double value = parse_double(&parser);
+
+            if (f->column_vars[j] >= 0)
+                record[f->column_vars[j]] = value;
+        }
+    }
+    reader->bytes += line_reader.next - f->offsets[cell];
+    f->offsets[cell] = line_reader.next;
+
+    close_line_reader(&line_reader);
+}
+
+/* classic VIC skips cells with run_cell 0, so their files may not exist */
+int is_active_cell(struct soil_s *soil, int cell)
+{
+    return soil->cells ? soil->cells->run_cell[cell] : soil->run_cell[cell];
+}
+
+/* classic file of a cell */
+static void cell_path(struct forcing_s *f, int cell, char *path)
+{
+    char suffix[BUF_SIZE];
+
+    cell_file_suffix(f->gp, f->soil, cell, suffix);
+    if (snprintf(path, BUF_SIZE, "%s%s", f->prefix, suffix) >= BUF_SIZE)
+        error("Path too long: %s\n", f->prefix);
+}
+
+/* lat_lon of a cell as classic VIC formats it with GRID_DECIMAL */
+void cell_file_suffix(struct global_params_s *gp, struct soil_s *soil,
+                      int cell, char *suffix)
+{
+    struct domain_s *domain = soil->domain;
+    int decimal = gp->grid_decimal;
+    int idx = soil->grid_idx[cell];
+
+    snprintf(suffix, BUF_SIZE, "%.*f_%.*f", decimal,
+             domain->lat->values[idx / domain->lon->n], decimal,
+             domain->lon->values[idx % domain->lon->n]);
+}
+
+/* record of step t of row i of a block of n cells */
+static float *record_at(struct forcing_s *f, struct year_s *y, float *buf,
+                        int n, int i, int t)
+{
+    int first = t / y->block_steps * y->block_steps;
+    int steps = y->n_steps - first < y->block_steps ?
+        y->n_steps - first : y->block_steps;
+
+    return buf + ((size_t)first * n + (size_t)i * steps + t - first) *
+        f->n_vars;
+}
+
+/* gather variable var of a block of steps of all cells into a
+ * [step][lat][lon] slab */
+static void write_steps(struct forcing_s *f, int steps, int var,
+                        const float *block, float *slab)
+{
+    struct domain_s *domain = f->soil->domain;
+    const int *grid_idx = f->soil->grid_idx;
+    size_t ngrid = (size_t)domain->lat->n * domain->lon->n;
+    size_t i;
+    int c, t;
+
+    for (i = 0; i < ngrid * steps; i++)
+        slab[i] = NC_FILL_FLOAT;
+
+    for (c = 0; c < f->soil->n_cells; c++) {
+        const float *records = block + (size_t)c * steps * f->n_vars + var;
+
+        for (t = 0; t < steps; t++)
+            slab[t * ngrid + grid_idx[c]] = records[(size_t)t * f->n_vars];
+    }
+}
+
+/* write or read size bytes at offset of a scratch file */
+void write_scratch(int fd, const void *buf, size_t size, off_t offset,
+                   const char *path)
+{
+    size_t done;
+    ssize_t count;
+
+    for (done = 0; done < size; done += count)
+        if ((count = pwrite(fd, (const char *)buf + done, size - done,
+                            offset + done)) < 0)
+            error("Cannot write file: %s\n", path);
+}
+
+void read_scratch(int fd, void *buf, size_t size, off_t offset,
+                  const char *path)
+{
+    size_t done;
+    ssize_t count;
+
+    for (done = 0; done < size; done += count)
+        if ((count = pread(fd, (char *)buf + done, size - done,
+                           offset + done)) <= 0)
+            error("Cannot read file: %s\n", path);
+}
+
+/* units of the image driver forcing variables */
+static const char *force_units(enum force_type force_type)
+{
+    switch (force_type) {
+    case AIR_TEMP:
+        return "C";
+    case CATM:
+        return "ppm";
+    case CHANNEL_IN:
+    case PREC:
+        return "mm";
+    case LAI:
+        return "m2/m2";
+    case LWDOWN:
+    case PAR:
+    case SWDOWN:
+        return "W/m2";
+    case PRESSURE:
+    case VP:
+        return "kPa";
+    case WIND:
+        return "m/s";
+    default:
+        return "1";
+    }
+}
+
+static double elapsed(struct timespec *start)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return end.tv_sec - start->tv_sec + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
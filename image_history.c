@@ -0,0 +1,842 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netcdf.h>
+#include "global.h"
+#include "double_stack.h"
+#include "line_reader.h"
+#include "parser.h"
+#include "vic.h"
+#include "stats.h"
+
+#define SECONDS_PER_DAY 86400
+/* YEAR, MONTH, DAY and SEC */
+#define DATE_COLUMNS 4
+
+/* the classic ASCII output files of one OUTFILE */
+struct history_s
+{
+    struct global_params_s *gp;
+    struct soil_s *soil;
+    int outfile;
+    char prefix[BUF_SIZE];      /* classic file of a cell:
+                                 * prefix_lat_lon.txt */
+    char image_prefix[BUF_SIZE];        /* image file:
+                                         * prefix.YYYY-MM-DD.nc */
+    struct outvar_s **outvars;
+    int n_outvars;
+    int *elements;              /* columns of each OUTVAR */
+    int *columns;               /* first value column of each OUTVAR */
+    int n_dates;                /* date columns of a record */
+    int n_values;               /* other columns of a record */
+    long n_records;
+    int *dates;                 /* [record][DATE_COLUMNS] */
+    long long *seconds;         /* of each record since 0001-01-01 */
+    long *offsets;              /* next record of each cell; 0 before the
+                                 * header */
+    int n_readers;
+    struct history_reader_s *readers;
+    pthread_t *threads;
+    /* the block of cells being read; the readers take its rows in turn */
+    struct history_file_s *file;
+    double *block;
+    int block_first, block_n;
+    int next_row;
+    pthread_mutex_t lock;
+    double read_seconds;
+};
+
+/* one of the I/O threads reading the files of a block of cells */
+struct history_reader_s
+{
+    struct history_s *h;
+    long files;
+    long long bytes;
+};
+
+/* the records of one history file, transposed in blocks as the forcing
+ * years are: [step block][cell][step][value] */
+struct history_file_s
+{
+    long first;                 /* first record of the file */
+    int n_steps;
+    int block_steps;            /* the last block may be shorter */
+    int block_cells;
+};
+
+static void convert_history(struct global_params_s *, struct soil_s *, int);
+static void read_header(struct history_s *);
+static void read_columns(struct history_s *, char *, const char *);
+static int is_header(const char *);
+static char *find_header(struct line_reader_s *, const char *);
+static long next_history_file(struct history_s *, long);
+static void convert_file(struct history_s *, struct history_file_s *);
+static void read_block(struct history_s *, struct history_file_s *, double *,
+                       int, int);
+static void *read_cells(void *);
+static int take_row(struct history_s *);
+static void prefetch_cell(struct history_s *, int);
+static void read_cell(struct history_reader_s *, int);
+static void cell_path(struct history_s *, int, char *);
+static double *record_at(struct history_s *, struct history_file_s *,
+                         double *, int, int, int);
+static void write_steps(struct history_s *, int, int, double,
+                        const double *, double *);
+static nc_type history_type(struct history_s *, enum out_type);
+static double fill_value(nc_type);
+static double elapsed(struct timespec *);
+
+/* convert the classic ASCII output files of every OUTFILE into image
+ * history files split by HISTFREQ, buffering at most about gp->max_memory
+ * bytes, or 1 GB if it is not set */
+void create_image_history(struct global_params_s *gp, struct soil_s *soil)
+{
+    int i;
+
+    if (!gp->n_outfiles)
+        error("No OUTFILE to convert\n");
+
+    for (i = 0; i < gp->n_outfiles; i++)
+        convert_history(gp, soil, i);
+}
+
+static void convert_history(struct global_params_s *gp, struct soil_s *soil,
+                            int outfile)
+{
+    struct history_s h;
+    struct history_file_s file;
+    long long bytes = 0;
+    long files = 0;
+    int i;
+
+    h.gp = gp;
+    h.soil = soil;
+    h.outfile = outfile;
+    h.outvars = gp->outvar[outfile];
+    h.n_outvars = gp->n_outvars[outfile];
+
+    if (gp->out_format[outfile] != ASCII)
+        error("Only ASCII output can be converted: %s\n",
+              gp->outfile[outfile]);
+    if (!h.n_outvars)
+        error("No OUTVAR to convert: %s\n", gp->outfile[outfile]);
+    if (!gp->result_dir)
+        error("RESULT_DIR is not set\n");
+
+    /* classic VIC names the file of a cell result_dir/outfile_lat_lon.txt */
+    snprintf(h.prefix, BUF_SIZE, "%s/%s_", gp->result_dir,
+             gp->outfile[outfile]);
+    snprintf(h.image_prefix, BUF_SIZE, "%s%s", gp->image_history,
+             gp->outfile[outfile]);
+
+    list_cell_files(gp, soil, h.prefix, ".txt", "output");
+    read_header(&h);
+
+    h.offsets = calloc(soil->n_cells, sizeof *h.offsets);
+
+    /* each reader hints its next file to the kernel while it reads one, so
+     * the readers together keep several files in flight */
+    h.n_readers = gp->io_threads > 1 ? gp->io_threads : 1;
+    h.readers = malloc(sizeof *h.readers * h.n_readers);
+    h.threads = malloc(sizeof *h.threads * h.n_readers);
+    for (i = 0; i < h.n_readers; i++) {
+        h.readers[i].h = &h;
+        h.readers[i].files = 0;
+        h.readers[i].bytes = 0;
+    }
+    pthread_mutex_init(&h.lock, NULL);
+    h.read_seconds = 0;
+
+    for (file.first = 0; file.first < h.n_records;
+         file.first += file.n_steps) {
+        file.n_steps = next_history_file(&h, file.first) - file.first;
+        convert_file(&h, &file);
+    }
+
+    for (i = 0; i < h.n_readers; i++) {
+        files += h.readers[i].files;
+        bytes += h.readers[i].bytes;
+    }
+    fprintf(stderr, "Read %ld output files (%.1f MB) in %.3f s, %.0f "
+            "files/s, %.1f MB/s: %s\n", files, bytes / 1e6, h.read_seconds,
+            h.read_seconds > 0 ? files / h.read_seconds : 0,
+            h.read_seconds > 0 ? bytes / 1e6 / h.read_seconds : 0,
+            h.prefix);
+    add_stats_seconds(gp->stats, "history.read", h.read_seconds, files,
+                      bytes);
+
+    free(h.elements);
+    free(h.columns);
+    free(h.dates);
+    free(h.seconds);
+    free(h.offsets);
+    free(h.readers);
+    free(h.threads);
+    pthread_mutex_destroy(&h.lock);
+}
+
+/* take the columns from the header of the first active cell and the dates
+ * of the records from its date columns; the other cells must have the same
+ * dates */
+static void read_header(struct history_s *h)
+{
+    struct global_params_s *gp = h->gp;
+    struct line_reader_s line_reader;
+    struct parser_s parser;
+    char path[BUF_SIZE], *line, *header;
+    long max_records = REALLOC_INCREMENT;
+    size_t length;
+    int cell, j;
+
+    for (cell = 0; cell < h->soil->n_cells; cell++)
+        if (is_active_cell(h->soil, cell))
+            break;
+    if (cell == h->soil->n_cells)
+        error("No active cell to convert: %s\n", h->prefix);
+
+    cell_path(h, cell, path);
+    open_line_reader(&line_reader, path);
+    init_parser_s(&parser, &line_reader);
+
+    parse_line(&parser, find_header(&line_reader, path));
+    line = parse_rest(&parser, &length);
+    header = malloc(length + 1);
+    memcpy(header, line, length);
+    header[length] = 0;
+    read_columns(h, header, path);
+    free(header);
+
+    h->n_records = 0;
+    h->dates = malloc(sizeof *h->dates * DATE_COLUMNS * max_records);
+    h->seconds = malloc(sizeof *h->seconds * max_records);
+    while ((line = read_line(&line_reader))) {
+        int *date;
+
+        parse_line(&parser, line);
+        if (is_blank_line(&parser))
+            continue;
+
+        if (h->n_records == max_records) {
+            max_records *= 2;
+            h->dates = realloc(h->dates, sizeof *h->dates * DATE_COLUMNS *
+                               max_records);
+            h->seconds = realloc(h->seconds,
+                                 sizeof *h->seconds * max_records);
+        }
+
+        /* the missing columns are the start of the year, month or day */
+        date = h->dates + h->n_records * DATE_COLUMNS;
+        date[1] = date[2] = 1;
+        date[3] = 0;
+        for (j = 0; j < h->n_dates; j++)
+            date[j] = parse_int(&parser);
+        h->seconds[h->n_records++] =
+            date_to_days(gp->calendar, date[0], date[1],
+                         date[2]) * (long long)SECONDS_PER_DAY + date[3];
+    }
+    if (!h->n_records)
+        error("No record to convert: %s\n", path);
+
+    close_line_reader(&line_reader);
+}
+
+/* the header is YEAR, the other date columns classic VIC writes for
+ * AGGFREQ, then each OUTVAR in order: its name, or name_0, name_1 and so
+ * on if it has several elements, such as soil layers */
+static void read_columns(struct history_s *h, char *header,
+                         const char *path)
+{
+    static const char *date_columns[] = { "YEAR", "MONTH", "DAY", "SEC" };
+    const char *sep = " \t\r\n#";
+    char *column = strtok(header, sep), name[BUF_SIZE];
+    int i, k;
+
+    for (h->n_dates = 0; h->n_dates < DATE_COLUMNS && column &&
+         strcmp(column, date_columns[h->n_dates]) == 0; h->n_dates++)
+        column = strtok(NULL, sep);
+
+    h->elements = malloc(sizeof *h->elements * h->n_outvars);
+    h->columns = malloc(sizeof *h->columns * h->n_outvars);
+    h->n_values = 0;
+    for (i = 0; i < h->n_outvars; i++) {
+        const char *var = h->outvars[i]->name;
+
+        h->columns[i] = h->n_values;
+        if (column && strcmp(column, var) == 0) {
+            h->elements[i] = 1;
+            column = strtok(NULL, sep);
+        }
+        else {
+            /* elements are numbered from 0, or from 1 by some versions */
+            for (k = 0; k < 2; k++) {
+                snprintf(name, BUF_SIZE, "%s_%d", var, k);
+                if (column && strcmp(column, name) == 0)
+                    break;
+            }
+            if (k == 2)
+                error("Cannot find OUTVAR %s in the header: %s\n", var,
+                      path);
+            for (h->elements[i] = 0; column; h->elements[i]++, k++) {
+                snprintf(name, BUF_SIZE, "%s_%d", var, k);
+                if (strcmp(column, name))
+                    break;
+                column = strtok(NULL, sep);
+            }
+        }
+        h->n_values += h->elements[i];
+    }
+
+    if (column)
+        error("Column %s is not an OUTVAR: %s\n", column, path);
+}
+
+/* the column names, possibly after a '#', start with YEAR; the lines before
+ * them describe the run */
+static int is_header(const char *line)
+{
+    line += strspn(line, " \t#");
+
+    return strncmp(line, "YEAR", 4) == 0 &&
+        strchr(" \t\r\n", line[4]) != NULL;
+}
+
+static char *find_header(struct line_reader_s *line_reader, const char *path)
+{
+    char *line;
+
+    do
+        if (!(line = read_line(line_reader)))
+            error("Cannot find the header: %s\n", path);
+    while (!is_header(line));
+
+    return line;
+}
+
+/* first record of the history file after the one starting at record first,
+ * following HISTFREQ; without it, or with NEVER or END, there is one file */
+static long next_history_file(struct history_s *h, long first)
+{
+    struct global_params_s *gp = h->gp;
+    struct freq_s *freq = gp->histfreq[h->outfile];
+    const int *date = h->dates + first * DATE_COLUMNS;
+    long long end;
+    long r;
+    int count, months;
+
+    if (!freq)
+        return h->n_records;
+    count = freq->count > 0 ? freq->count : 1;
+
+    switch (freq->frequency) {
+    case NSTEPS:
+        return h->n_records - first > count ? first + count : h->n_records;
+    case NSECONDS:
+        end = h->seconds[first] + count;
+        break;
+    case NMINUTES:
+        end = h->seconds[first] + count * 60LL;
+        break;
+    case NHOURS:
+        end = h->seconds[first] + count * 3600LL;
+        break;
+    case NDAYS:
+        end = h->seconds[first] + count * (long long)SECONDS_PER_DAY;
+        break;
+    case NMONTHS:
+        months = date[1] - 1 + count;
+        end = date_to_days(gp->calendar, date[0] + months / 12,
+                           months % 12 + 1,
+                           date[2]) * (long long)SECONDS_PER_DAY + date[3];
+        break;
+    case NYEARS:
+        end = date_to_days(gp->calendar, date[0] + count, date[1],
+                           date[2]) * (long long)SECONDS_PER_DAY + date[3];
+        break;
+    case DATE:
+        end = date_to_days(gp->calendar, freq->year, freq->month,
+                           freq->day) * (long long)SECONDS_PER_DAY +
+            freq->second;
+        if (end <= h->seconds[first])
+            return h->n_records;
+        break;
+    default:
+        return h->n_records;
+    }
+
+    for (r = first + 1; r < h->n_records && h->seconds[r] < end; r++) ;
+
+    return r;
+}
+
+static void convert_file(struct history_s *h, struct history_file_s *file)
+{
+    static const char *time_units[] =
+        { "seconds", "minutes", "hours", "days" };
+    static const int unit_seconds[] = { 1, 60, 3600, SECONDS_PER_DAY };
+    struct global_params_s *gp = h->gp;
+    struct soil_s *soil = h->soil;
+    struct domain_s *domain = soil->domain;
+    struct freq_s *freq = gp->histfreq[h->outfile];
+    int n_cells = soil->n_cells;
+    size_t ngrid = (size_t)domain->lat->n * domain->lon->n;
+    size_t record_bytes = sizeof(double) * h->n_values;
+    size_t block_size;
+    const int *date = h->dates + file->first * DATE_COLUMNS;
+    const char *calendar = calendar_name(gp->calendar);
+    int level = gp->compress[h->outfile];
+    char path[BUF_SIZE], scratch_path[BUF_SIZE], units[BUF_SIZE];
+    int ncid, dimids[4], time_varid, lat_varid, lon_varid, *varids;
+    int *element_dimids, n_element_dims = 0;
+    double *times, *buf, *slab, *fills;
+    int scratch = -1;
+    int i, j, c, b, t, n, n_blocks;
+
+    /* the second pass buffers block_steps records of every cell and one
+     * [step][lat][lon] slab; the first pass block_cells cells */
+    transpose_blocks(gp, n_cells, file->n_steps, record_bytes,
+                     sizeof(double) * ngrid, &file->block_cells,
+                     &file->block_steps);
+    n_blocks = (file->n_steps + file->block_steps - 1) / file->block_steps;
+
+    /* named as the image driver names them, with the seconds if the files
+     * are split within a day */
+    if (freq && (freq->frequency == NSTEPS || freq->frequency == NSECONDS ||
+                 freq->frequency == NMINUTES || freq->frequency == NHOURS))
+        n = snprintf(path, BUF_SIZE, "%s.%04d-%02d-%02d-%05d.nc",
+                     h->image_prefix, date[0], date[1], date[2], date[3]);
+    else
+        n = snprintf(path, BUF_SIZE, "%s.%04d-%02d-%02d.nc",
+                     h->image_prefix, date[0], date[1], date[2]);
+    if (n >= BUF_SIZE)
+        error("Path too long: %s\n", h->image_prefix);
+
+    nc_check(nc_create(path, level ? NC_CLOBBER | NC_NETCDF4 :
+                       NC_CLOBBER | NC_64BIT_OFFSET, &ncid),
+             "Cannot create file: %s\n", path);
+
+    nc_check(nc_def_dim(ncid, "time", NC_UNLIMITED, &dimids[0]),
+             "Cannot define dimension: %s\n", "time");
+    nc_check(nc_def_dim(ncid, "lat", domain->lat->n, &dimids[2]),
+             "Cannot define dimension: %s\n", "lat");
+    nc_check(nc_def_dim(ncid, "lon", domain->lon->n, &dimids[3]),
+             "Cannot define dimension: %s\n", "lon");
+
+    nc_check(nc_def_var(ncid, "time", NC_DOUBLE, 1, dimids, &time_varid),
+             "Cannot define variable: %s\n", "time");
+    sprintf(units, "%s since %04d-%02d-%02d %02d:%02d:%02d",
+            time_units[gp->out_time_units], date[0], date[1], date[2],
+            date[3] / 3600, date[3] / 60 % 60, date[3] % 60);
+    nc_check(nc_put_att_text(ncid, time_varid, "units", strlen(units),
+                             units), "Cannot put attribute: %s\n", "time");
+    nc_check(nc_put_att_text(ncid, time_varid, "calendar", strlen(calendar),
+                             calendar), "Cannot put attribute: %s\n",
+             "time");
+    nc_check(nc_def_var(ncid, "lat", NC_DOUBLE, 1, dimids + 2, &lat_varid),
+             "Cannot define variable: %s\n", "lat");
+    nc_check(nc_def_var(ncid, "lon", NC_DOUBLE, 1, dimids + 3, &lon_varid),
+             "Cannot define variable: %s\n", "lon");
+
+    /* variables of several elements have a dimension between time and lat,
+     * shared by those of the same length */
+    varids = malloc(sizeof *varids * h->n_outvars);
+    fills = malloc(sizeof *fills * h->n_outvars);
+    element_dimids = malloc(sizeof *element_dimids * h->n_outvars);
+    for (i = 0; i < h->n_outvars; i++) {
+        struct outvar_s *outvar = h->outvars[i];
+        nc_type type = history_type(h, outvar->out_type);
+        int var_dimids[4] = { dimids[0], -1, dimids[2], dimids[3] };
+
+        if (h->elements[i] > 1) {
+            char name[BUF_SIZE];
+            size_t len;
+
+            if (h->elements[i] == gp->nlayer)
+                strcpy(name, "nlayer");
+            else if (h->elements[i] == gp->nodes)
+                strcpy(name, "nnode");
+            else if (gp->snow_band && h->elements[i] == gp->snow_band->bands)
+                strcpy(name, "snow_band");
+            else
+                sprintf(name, "element%d", h->elements[i]);
+
+            for (j = 0; j < n_element_dims; j++) {
+                nc_check(nc_inq_dimlen(ncid, element_dimids[j], &len),
+                         "Cannot inquire dimension: %d\n",
+                         element_dimids[j]);
+                if (len == (size_t)h->elements[i])
+                    break;
+            }
+            if (j == n_element_dims)
+                nc_check(nc_def_dim(ncid, name, h->elements[i],
+                                    &element_dimids[n_element_dims++]),
+                         "Cannot define dimension: %s\n", name);
+            var_dimids[1] = element_dimids[j];
+        }
+
+        if (var_dimids[1] >= 0)
+            nc_check(nc_def_var(ncid, outvar->name, type, 4, var_dimids,
+                                &varids[i]), "Cannot define variable: %s\n",
+                     outvar->name);
+        else {
+            var_dimids[1] = dimids[0];
+            nc_check(nc_def_var(ncid, outvar->name, type, 3,
+                                var_dimids + 1, &varids[i]),
+                     "Cannot define variable: %s\n", outvar->name);
+        }
+        fills[i] = fill_value(type);
+    }
+    free(element_dimids);
+
+    deflate_image_vars(ncid, dimids[2], dimids[3], level);
+
+    nc_check(nc_enddef(ncid), "Cannot end definition\n");
+
+    times = malloc(sizeof *times * file->n_steps);
+    for (t = 0; t < file->n_steps; t++)
+        times[t] = (double)(h->seconds[file->first + t] -
+                            h->seconds[file->first]) /
+            unit_seconds[gp->out_time_units];
+    {
+        size_t start = 0, count = file->n_steps;
+
+        nc_check(nc_put_vara_double(ncid, time_varid, &start, &count,
+                                    times), "Cannot put variable: %s\n",
+                 "time");
+    }
+    free(times);
+    nc_check(nc_put_var_double(ncid, lat_varid, domain->lat->values),
+             "Cannot put variable: %s\n", "lat");
+    nc_check(nc_put_var_double(ncid, lon_varid, domain->lon->values),
+             "Cannot put variable: %s\n", "lon");
+
+    /* first pass: read blocks of cells and spill them to the scratch file
+     * unless all cells fit in one block */
+    block_size = (size_t)file->block_cells * file->n_steps * h->n_values;
+    if (!(buf = malloc(sizeof *buf * block_size)))
+        error("Cannot allocate %zu bytes\n", sizeof *buf * block_size);
+
+    if (file->block_cells < n_cells) {
+        if (snprintf(scratch_path, BUF_SIZE, "%sscratch",
+                     h->image_prefix) >= BUF_SIZE)
+            error("Path too long: %s\n", h->image_prefix);
+        if ((scratch = open(scratch_path, O_RDWR | O_CREAT | O_TRUNC,
+                            0600)) < 0)
+            error("Cannot create file: %s\n", scratch_path);
+        /* removed as soon as it is closed, including by exiting */
+        unlink(scratch_path);
+    }
+
+    for (c = 0; c < n_cells; c += file->block_cells) {
+        int n = n_cells - c < file->block_cells ? n_cells - c :
+            file->block_cells;
+
+        read_block(h, file, buf, c, n);
+
+        if (scratch < 0)
+            break;
+
+        for (b = 0; b < n_blocks; b++) {
+            int first = b * file->block_steps;
+            int steps = file->n_steps - first < file->block_steps ?
+                file->n_steps - first : file->block_steps;
+
+            write_scratch(scratch, record_at(h, file, buf, n, 0, first),
+                          record_bytes * n * steps,
+                          (off_t)record_bytes * ((size_t)first * n_cells +
+                                                 (size_t)c * steps),
+                          scratch_path);
+        }
+    }
+
+    /* second pass: read blocks of steps of all cells and write them */
+    if (scratch >= 0) {
+        free(buf);
+        if (!(buf = malloc(record_bytes * n_cells * file->block_steps)))
+            error("Cannot allocate %zu bytes\n",
+                  record_bytes * n_cells * file->block_steps);
+    }
+    if (!(slab = malloc(sizeof *slab * ngrid * file->block_steps)))
+        error("Cannot allocate %zu bytes\n",
+              sizeof *slab * ngrid * file->block_steps);
+
+    for (b = 0; b < n_blocks; b++) {
+        int first = b * file->block_steps;
+        int steps = file->n_steps - first < file->block_steps ?
+            file->n_steps - first : file->block_steps;
+        const double *block;
+
+        if (scratch >= 0) {
+            read_scratch(scratch, buf, record_bytes * n_cells * steps,
+                         (off_t)record_bytes * first * n_cells,
+                         scratch_path);
+            block = buf;
+        }
+        else
+            block = record_at(h, file, buf, n_cells, 0, first);
+
+        for (i = 0; i < h->n_outvars; i++)
+            for (j = 0; j < h->elements[i]; j++) {
+                size_t start[4] = { first, j, 0, 0 };
+                size_t count[4] = { steps, 1, domain->lat->n,
+                    domain->lon->n
+                };
+
+                if (h->elements[i] == 1) {
+                    start[1] = 0;
+                    count[1] = domain->lat->n;
+                    count[2] = domain->lon->n;
+                }
+                write_steps(h, steps, h->columns[i] + j, fills[i], block,
+                            slab);
+                nc_check(nc_put_vara_double(ncid, varids[i], start, count,
+                                            slab),
+                         "Cannot put variable: %s\n", h->outvars[i]->name);
+            }
+    }
+
+    if (scratch >= 0)
+        close(scratch);
+    free(buf);
+    free(slab);
+    free(varids);
+    free(fills);
+
+    nc_check(nc_close(ncid), "Cannot close file: %s\n", path);
+}
+
+/* read the records of the file of cells c to c + n - 1 into buf with the
+ * reader pool */
+static void read_block(struct history_s *h, struct history_file_s *file,
+                       double *buf, int c, int n)
+{
+    int n_threads = h->n_readers < n ? h->n_readers : n;
+    struct timespec start;
+    int i;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    h->file = file;
+    h->block = buf;
+    h->block_first = c;
+    h->block_n = n;
+    h->next_row = 0;
+
+    if (n_threads <= 1)
+        read_cells(&h->readers[0]);
+    else {
+        for (i = 0; i < n_threads; i++)
+            if (pthread_create(&h->threads[i], NULL, read_cells,
+                               &h->readers[i]))
+                error("Cannot create thread\n");
+        for (i = 0; i < n_threads; i++)
+            pthread_join(h->threads[i], NULL);
+    }
+
+    h->read_seconds += elapsed(&start);
+}
+
+/* take rows until none is left, hinting the next file of this reader to
+ * the kernel before reading the current one */
+static void *read_cells(void *arg)
+{
+    struct history_reader_s *reader = arg;
+    int i = take_row(reader->h), next;
+
+    while (i >= 0) {
+        if ((next = take_row(reader->h)) >= 0)
+            prefetch_cell(reader->h, next);
+        read_cell(reader, i);
+        i = next;
+    }
+
+    return NULL;
+}
+
+/* next row of the block to read, or -1 */
+static int take_row(struct history_s *h)
+{
+    int i = -1;
+
+    pthread_mutex_lock(&h->lock);
+    if (h->next_row < h->block_n)
+        i = h->next_row++;
+    pthread_mutex_unlock(&h->lock);
+
+    return i;
+}
+
+/* start reading the rest of the file of row i in the background; the
+ * records of the later history files follow, so it is read to the end */
+static void prefetch_cell(struct history_s *h, int i)
+{
+    int cell = h->block_first + i;
+    char path[BUF_SIZE];
+    int fd;
+
+    if (!is_active_cell(h->soil, cell))
+        return;
+
+    cell_path(h, cell, path);
+    /* errors are reported when it is read */
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return;
+    posix_fadvise(fd, h->offsets[cell], 0, POSIX_FADV_WILLNEED);
+    close(fd);
+}
+
+/* read the records of the file of row i of the block; their dates must be
+ * those of the first active cell */
+static void read_cell(struct history_reader_s *reader, int i)
+{
+    struct history_s *h = reader->h;
+    struct history_file_s *file = h->file;
+    int cell = h->block_first + i;
+    struct line_reader_s line_reader;
+    struct parser_s parser;
+    char path[BUF_SIZE], *line;
+    int t, j;
+
+    if (!is_active_cell(h->soil, cell)) {
+        for (t = 0; t < file->n_steps; t++) {
+            double *record = record_at(h, file, h->block, h->block_n, i, t);
+
+            for (j = 0; j < h->n_values; j++)
+                record[j] = NC_FILL_DOUBLE;
+        }
+        return;
+    }
+
+    cell_path(h, cell, path);
+    open_line_reader(&line_reader, path);
+    init_parser_s(&parser, &line_reader);
+    if (h->offsets[cell])
+        seek_line(&line_reader, h->offsets[cell]);
+    else
+        find_header(&line_reader, path);
+
+    for (t = 0; t < file->n_steps; t++) {
+        const int *date = h->dates + (file->first + t) * DATE_COLUMNS;
+        double *record = record_at(h, file, h->block, h->block_n, i, t);
+
+        while ((line = read_line(&line_reader))) {
+            parse_line(&parser, line);
+            if (!is_blank_line(&parser))
+                break;
+        }
+        if (!line)
+            error("Cannot read %ld records: %s\n", h->n_records, path);
+
+        for (j = 0; j < h->n_dates; j++)
+            if (parse_int(&parser) != date[j])
+                error("Record %ld has another date than in the first "
+                      "file at line %ld: %s\n", file->first + t + 1,
+                      line_number(&line_reader), path);
+        for (j = 0; j < h->n_values; j++)
+            record[j] = parse_double(&parser);
+    }
+    reader->bytes += line_reader.next - h->offsets[cell];
+    h->offsets[cell] = line_reader.next;
+    reader->files++;
+
+    close_line_reader(&line_reader);
+}
+
+/* classic output file of a cell */
+static void cell_path(struct history_s *h, int cell, char *path)
+{
+    char suffix[BUF_SIZE];
+
+    cell_file_suffix(h->gp, h->soil, cell, suffix);
+    if (snprintf(path, BUF_SIZE, "%s%s.txt", h->prefix, suffix) >= BUF_SIZE)
+        error("Path too long: %s\n", h->prefix);
+}
+
+/* record of step t of row i of a block of n cells */
+static double *record_at(struct history_s *h, struct history_file_s *file,
+                         double *buf, int n, int i, int t)
+{
+    int first = t / file->block_steps * file->block_steps;
+    int steps = file->n_steps - first < file->block_steps ?
+        file->n_steps - first : file->block_steps;
+
+    return buf + ((size_t)first * n + (size_t)i * steps + t - first) *
+        h->n_values;
+}
+
+/* gather value column of a block of steps of all cells into a
+ * [step][lat][lon] slab; inactive cells and cells outside the domain get
+ * the fill value of the variable */
+static void write_steps(struct history_s *h, int steps, int column,
+                        double fill, const double *block, double *slab)
+{
+    struct domain_s *domain = h->soil->domain;
+    const int *grid_idx = h->soil->grid_idx;
+    size_t ngrid = (size_t)domain->lat->n * domain->lon->n;
+    size_t i;
+    int c, t;
+
+    for (i = 0; i < ngrid * steps; i++)
+        slab[i] = fill;
+
+    for (c = 0; c < h->soil->n_cells; c++) {
+        const double *records =
+            block + (size_t)c * steps * h->n_values + column;
+
+        if (!is_active_cell(h->soil, c))
+            continue;
+        for (t = 0; t < steps; t++)
+            slab[t * ngrid + grid_idx[c]] = records[(size_t)t * h->n_values];
+    }
+}
+
+/* NetCDF type of an OUTVAR as the image driver writes it; the classic
+ * format has no unsigned short, so only compressed NetCDF-4 files have
+ * one */
+static nc_type history_type(struct history_s *h, enum out_type out_type)
+{
+    switch (out_type) {
+    case OUT_TYPE_CHAR:
+        return NC_BYTE;
+    case OUT_TYPE_SINT:
+        return NC_SHORT;
+    case OUT_TYPE_USINT:
+        return h->gp->compress[h->outfile] ? NC_USHORT : NC_INT;
+    case OUT_TYPE_INT:
+        return NC_INT;
+    case OUT_TYPE_DOUBLE:
+        return NC_DOUBLE;
+    default:
+        return NC_FLOAT;
+    }
+}
+
+static double fill_value(nc_type type)
+{
+    switch (type) {
+    case NC_BYTE:
+        return NC_FILL_BYTE;
+    case NC_SHORT:
+        return NC_FILL_SHORT;
+    case NC_USHORT:
+        return NC_FILL_USHORT;
+    case NC_INT:
+        return NC_FILL_INT;
+    case NC_DOUBLE:
+        return NC_FILL_DOUBLE;
+    default:
+        return NC_FILL_FLOAT;
+    }
+}
+
+static double elapsed(struct timespec *start)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return end.tv_sec - start->tv_sec + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
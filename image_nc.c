@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <netcdf.h>
+#include "global.h"
+#include "vic.h"
+
+/* largest chunk of a [...][lat][lon] variable; the image driver reads whole
+ * lat x lon slabs, so a chunk is one slab unless that is larger, and the
+ * chunk cache holds the chunks of a block of lat rows being written */
+#define MAX_CHUNK_BYTES (4 * 1024 * 1024)
+
+/* largest classic format file with 32-bit offsets, leaving room for the
+ * header */
+#define CLASSIC_BYTES (((size_t)1 << 31) - ((size_t)1 << 24))
+
+/* memory of the transposes of the forcing and output files without
+ * --max-memory */
+#define TRANSPOSE_BYTES ((size_t)1024 * 1024 * 1024)
+
+/* mode of a parameters, domain or state file of at most bytes of
+ * variables: classic format, with 64-bit offsets if it is too large for
+ * 32-bit ones, or NetCDF-4 if it is compressed */
+int image_create_mode(struct global_params_s *gp, size_t bytes)
+{
+    if (gp->compress_level)
+        return NC_CLOBBER | NC_NETCDF4;
+
+    return bytes < CLASSIC_BYTES ? NC_CLOBBER : NC_CLOBBER | NC_64BIT_OFFSET;
+}
+
+/* chunk every variable defined so far whose last dimensions are lat and lon
+ * by lat x lon slabs, and deflate it with shuffling at gp->compress_level;
+ * the others are small and left contiguous */
+void chunk_image_vars(struct global_params_s *gp, int ncid, int lat_dimid,
+                      int lon_dimid)
+{
+    deflate_image_vars(ncid, lat_dimid, lon_dimid, gp->compress_level);
+}
+
+/* the same at level, such as the COMPRESS of an output file */
+void deflate_image_vars(int ncid, int lat_dimid, int lon_dimid, int level)
+{
+    int nvars, varid, ndims, dimids[NC_MAX_VAR_DIMS];
+    size_t chunks[NC_MAX_VAR_DIMS], nlat, nlon, size;
+    nc_type type;
+    int i;
+
+    if (!level)
+        return;
+
+    nc_check(nc_inq_nvars(ncid, &nvars), "Cannot inquire variables\n");
+    nc_check(nc_inq_dimlen(ncid, lat_dimid, &nlat),
+             "Cannot inquire dimension: lat\n");
+    nc_check(nc_inq_dimlen(ncid, lon_dimid, &nlon),
+             "Cannot inquire dimension: lon\n");
+
+    for (varid = 0; varid < nvars; varid++) {
+        nc_check(nc_inq_varndims(ncid, varid, &ndims),
+                 "Cannot inquire variable: %d\n", varid);
+        nc_check(nc_inq_vardimid(ncid, varid, dimids),
+                 "Cannot inquire variable: %d\n", varid);
+        if (ndims < 2 || dimids[ndims - 2] != lat_dimid ||
+            dimids[ndims - 1] != lon_dimid)
+            continue;
+
+        nc_check(nc_inq_vartype(ncid, varid, &type),
+                 "Cannot inquire variable: %d\n", varid);
+        nc_check(nc_inq_type(ncid, type, NULL, &size),
+                 "Cannot inquire variable: %d\n", varid);
+
+        for (i = 0; i < ndims - 2; i++)
+            chunks[i] = 1;
+        chunks[ndims - 2] = MAX_CHUNK_BYTES / (nlon * size);
+        if (chunks[ndims - 2] < 1)
+            chunks[ndims - 2] = 1;
+        if (chunks[ndims - 2] > nlat)
+            chunks[ndims - 2] = nlat;
+        chunks[ndims - 1] = nlon;
+
+        nc_check(nc_def_var_chunking(ncid, varid, NC_CHUNKED, chunks),
+                 "Cannot chunk variable: %d\n", varid);
+        nc_check(nc_def_var_deflate(ncid, varid, 1, 1, level),
+                 "Cannot deflate variable: %d\n", varid);
+    }
+}
+
+/* blocks of a transpose of n_steps records of record_bytes of each of
+ * n_cells cells into [step][lat][lon] slabs of slab_bytes, within
+ * --max-memory or TRANSPOSE_BYTES: the second pass buffers block_steps
+ * records of every cell and their slabs, the first pass block_cells cells */
+void transpose_blocks(struct global_params_s *gp, int n_cells, int n_steps,
+                      size_t record_bytes, size_t slab_bytes,
+                      int *block_cells, int *block_steps)
+{
+    size_t memory = gp->max_memory ? gp->max_memory : TRANSPOSE_BYTES;
+    size_t steps = memory / (record_bytes * n_cells + slab_bytes);
+    size_t cells = memory / (record_bytes * n_steps);
+
+    if (steps < 1)
+        steps = 1;
+    if (steps > (size_t)n_steps)
+        steps = n_steps;
+    if (cells < 1)
+        cells = 1;
+    if (cells > (size_t)n_cells)
+        cells = n_cells;
+
+    *block_steps = steps;
+    *block_cells = cells;
+}
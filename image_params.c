@@ -1,14 +1,145 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
 #include <netcdf.h>
 #include "global.h"
 #include "double_stack.h"
+#include "arena.h"
+#include "line_reader.h"
+#include "nc_writer.h"
 #include "vic.h"
+#include "stats.h"
+
+/* variables of a block of lat rows, more than the parameters file has */
+#define MAX_PARAM_VARS 96
+
+/* how a variable of a block is gathered into its staging buffer */
+enum gather_kind
+{
+    GATHER_CELL_INTS,           /* one int per cell */
+    GATHER_MASK,                /* one int per grid cell */
+    GATHER_SOIL,
+    GATHER_SNOW_BANDS,
+    GATHER_NVEG,
+    GATHER_VEG,                 /* vegetation parameters and library */
+    GATHER_VEG_LIB_INTS
+};
+
+/* the --stats stages of the variables */
+enum param_stage
+{
+    LOCATION_VARS,
+    SOIL_VARS,
+    SNOW_BAND_VARS,
+    VEG_VARS,
+    N_PARAM_STAGES
+};
+
+static const char *param_stage_names[] = {
+    "params.location_vars",
+    "params.soil_vars",
+    "params.snow_band_vars",
+    "params.veg_vars"
+};
+
+/* per-class ints of the vegetation library */
+enum class_ints
+{
+    OVERSTORY,
+    CTYPE,
+    NSCALE_FLAG,
+    N_CLASS_INTS
+};
+
+struct param_var_s
+{
+    enum gather_kind kind;
+    enum param_stage stage;
+    int varid;
+    const char *name;
+    size_t nvalues;             /* values per grid cell */
+    double fill;
+    const int *ints;            /* CELL_INTS, MASK and VEG_LIB_INTS */
+    const double *field;        /* SOIL */
+    int count;                  /* layers of SOIL, band value of SNOW_BANDS,
+                                 * values per tile of VEG */
+    int veg_params_offset;      /* VEG; -1 if not from the vegparam file */
+    int veg_lib_offset;         /* VEG; -1 if not from the library */
+};
+
+/* one block of lat rows whose variables are gathered by gp->threads
+ * workers, the calling thread included, into the free staging buffers of
+ * the writer thread, so that the gathers run in parallel with each other
+ * and with the writes */
+struct param_block_s
+{
+    struct veg_lib_s *veg_lib;
+    struct nc_writer_s *writer;
+    int timed;
+    size_t row, rows, ngrid;
+    int n_cells;
+    int nalloc;                 /* stride of the soil table */
+    int bands;
+    const int *grid_idx;
+    struct veg_cell_s **veg_cells;
+    int **class_idx;
+    const double **band_cells;
+    enum param_stage stage;     /* of the variables being added */
+    int n_added;
+    struct param_var_s vars[MAX_PARAM_VARS];
+    /* shared with the workers */
+    int n_vars, next_var, n_done, quit;
+    int stage_vars[N_PARAM_STAGES];
+    double stage_seconds[N_PARAM_STAGES];
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int n_workers;
+    pthread_t *workers;
+};
+
+static void init_param_block_s(struct param_block_s *, int);
+static void free_param_block_s(struct param_block_s *);
+static struct param_var_s *add_param_var(struct param_block_s *,
+                                         enum gather_kind, int, const char *,
+                                         size_t);
+static void add_cell_ints(struct param_block_s *, int, const char *,
+                          const int *);
+static void add_soil(struct param_block_s *, int, const char *,
+                     const double *, int);
+static void add_snow_bands(struct param_block_s *, int, const char *, int);
+static struct param_var_s *add_veg(struct param_block_s *, int, const char *,
+                                   int, int, int);
+static void add_veg_lib_ints(struct param_block_s *, int, const char *,
+                             const int *);
+static void gather_param_block(struct param_block_s *);
+static void *run_param_worker(void *);
+static int take_param_var(struct param_block_s *, int);
+static void gather_param_var(struct param_block_s *, struct param_var_s *);
+static size_t params_bytes(struct global_params_s *, struct veg_lib_s *,
+                           struct domain_s *);
+static size_t row_bytes(struct global_params_s *, struct veg_lib_s *,
+                        size_t, int, int);
+static void fill_ints(int *, size_t, int);
+static void fill_doubles(double *, size_t, double);
+static void gather_soil(const double *, int, int, const int *, size_t, int,
+                        double *);
+static void gather_snow_bands(int, const double **, const int *, size_t,
+                              int, int, double *);
+static void gather_veg_params(int, struct veg_cell_s **, int **,
+                              const int *, size_t, size_t, int, double *);
+static void gather_veg_lib(int, struct veg_lib_s *, struct veg_cell_s **,
+                           int **, const int *, size_t, size_t, int,
+                           double *);
+static void gather_veg_lib_ints(int, struct veg_cell_s **, int **,
+                                const int *, size_t, const int *, int *);
 
 void create_image_params(struct global_params_s *gp, struct soil_s *soil,
                          struct veg_lib_s *veg_lib,
-                         struct veg_params_s *veg_params)
+                         struct veg_params_s *veg_params,
+                         struct snow_band_params_s *snow_bands)
 {
     int ncid;
     int veg_class_dimid, string_dimid, root_zone_dimid, snow_band_dimid,
@@ -29,6 +160,8 @@ void create_image_params(struct global_params_s *gp, struct soil_s *soil,
         rough_varid, snow_rough_varid, annual_prec_varid, resid_moist_varid,
         fs_active_varid, frost_slope_varid, max_snow_distrib_slope_varid,
         July_Tavg_varid;
+    /* snow band variables */
+    int AreaFract_varid, elevation_varid, Pfactor_varid;
     /* vegetation variables */
     int Nveg_varid, Cv_varid, root_depth_varid, root_fract_varid,
         sigma_slope_varid, lag_one_varid, fetch_varid, LAI_varid,
@@ -38,17 +171,41 @@ void create_image_params(struct global_params_s *gp, struct soil_s *soil,
         MaxCarboxRate_varid, MaxETransport_varid, LightUseEff_varid,
         NscaleFlag_varid, Wnpp_inhib_varid, NPPfactor_sat_varid;
     int dimids[4];
-    int *ints, nints;
-    size_t start[4], count[4];
+    int *ints, nints, *class_ints[N_CLASS_INTS], nvalues, nclass_values;
+    double *doubles;
+    size_t nlat, nlon, row, rows, block_rows, ngrid;
+    int n_cells, max_cells;
+    int *grid_idx, **class_idx;
+    struct soil_table_s *cells, *block_cells;
+    struct veg_cell_s **veg_cells, *veg_cell_buf;
+    const double **band_cells;
+    double *band_cell_buf;
+    struct line_reader_s *soil_reader, *veg_reader, *band_reader;
+    struct arena_s block_arena;
+    struct nc_writer_s writer;
+    struct param_block_s block;
+    struct param_var_s *var;
+    size_t staging_bytes;
+    struct timespec start;
     int veg_descr_len;
     int d;
     int i;
     double double_fill = 0;
 
+    start_stats_timer(gp->stats, &start);
+
     /* dimensions */
-    nc_check(nc_create(gp->parameters, NC_CLOBBER, &ncid),
+    nc_check(nc_create(gp->parameters,
+                       image_create_mode(gp, params_bytes(gp, veg_lib,
+                                                          soil->domain)),
+                       &ncid),
              "Cannot create file: %s\n", gp->parameters);
 
+    /* every value is written once from the staging buffers, fill values
+     * included, so prefilling the variables would write them twice */
+    nc_check(nc_set_fill(ncid, NC_NOFILL, NULL),
+             "Cannot set fill mode: %s\n", gp->parameters);
+
     nints = 12;
 
     if (veg_lib->n_classes > nints)
@@ -248,6 +405,23 @@ void create_image_params(struct global_params_s *gp, struct soil_s *soil,
                  (ncid, "July_Tavg", NC_DOUBLE, d - 1, dimids + 1,
                   &July_Tavg_varid), "Cannot define variable: July_Tavg\n");
 
+    /* snow band variables */
+    if (snow_bands) {
+        d = 0;
+        dimids[d++] = snow_band_dimid;
+        dimids[d++] = lat_dimid;
+        dimids[d++] = lon_dimid;
+        nc_check(nc_def_var
+                 (ncid, "AreaFract", NC_DOUBLE, d, dimids, &AreaFract_varid),
+                 "Cannot define variable: AreaFract\n");
+        nc_check(nc_def_var
+                 (ncid, "elevation", NC_DOUBLE, d, dimids, &elevation_varid),
+                 "Cannot define variable: elevation\n");
+        nc_check(nc_def_var
+                 (ncid, "Pfactor", NC_DOUBLE, d, dimids, &Pfactor_varid),
+                 "Cannot define variable: Pfactor\n");
+    }
+
     /* vegetation variables */
     nc_check(nc_def_var(ncid, "Nveg", NC_INT, d - 1, dimids + 1, &Nveg_varid),
              "Cannot define variable: Nveg\n");
@@ -379,9 +553,13 @@ void create_image_params(struct global_params_s *gp, struct soil_s *soil,
                  "Cannot define variable: NPPfactor_sat\n");
     }
 
+    chunk_image_vars(gp, ncid, lat_dimid, lon_dimid);
+
     nc_check(nc_enddef(ncid), "Cannot end definition\n");
+    add_stats(gp->stats, "params.define", &start, 0, 0);
 
     /* populate variables */
+    start_stats_timer(gp->stats, &start);
     ints = malloc(sizeof *ints * nints);
     for (i = 0; i < nints; i++)
         ints[i] = i + 1;
@@ -404,399 +582,794 @@ void create_image_params(struct global_params_s *gp, struct soil_s *soil,
 
     free(ints);
 
-    /* vegetation variables */
-    start[1] = 0;
-    count[0] = 1;
-    for (i = 0; i < veg_lib->n_classes; i++) {
-        start[0] = i;
-        count[1] = strlen(veg_lib->classes[i]->comment);
-        nc_check(nc_put_vara
-                 (ncid, veg_descr_varid, start, count,
-                  veg_lib->classes[i]->comment),
+    /* vegetation variables; the descriptions are padded with the fill
+     * value */
+    if (veg_descr_len) {
+        char *chars = calloc((size_t)veg_lib->n_classes * veg_descr_len, 1);
+
+        for (i = 0; i < veg_lib->n_classes; i++)
+            memcpy(chars + (size_t)i * veg_descr_len,
+                   veg_lib->classes[i]->comment,
+                   strlen(veg_lib->classes[i]->comment));
+        nc_check(nc_put_var(ncid, veg_descr_varid, chars),
                  "Cannot put variable: veg_descr\n");
+        free(chars);
     }
 
-    for (i = 0; i < soil->n_cells; i++) {
-        int run_cell = soil->cells[i]->run_cell, fs_active =
-            soil->cells[i]->fs_active;
-        int lat_idx, lon_idx, mask_idx, vp_idx;
-        int j;
+    add_stats(gp->stats, "params.dimension_vars", &start, 0, 0);
+
+    nlat = soil->domain->lat->n;
+    nlon = soil->domain->lon->n;
+
+    /* every variable is staged and written one block of lat rows at a
+     * time; all rows make up one block on one thread unless in streaming
+     * mode */
+    nvalues = gp->nlayer;
+    if (veg_lib->n_classes * 12 > nvalues)
+        nvalues = veg_lib->n_classes * 12;
+    if (veg_lib->n_classes * veg_params->root_zones > nvalues)
+        nvalues = veg_lib->n_classes * veg_params->root_zones;
+    if (snow_bands && snow_bands->bands > nvalues)
+        nvalues = snow_bands->bands;
+    nclass_values = veg_lib->n_classes > 1 ? veg_lib->n_classes : 1;
+
+    if (gp->max_memory) {
+        block_rows =
+            gp->max_memory / row_bytes(gp, veg_lib, nlon, nvalues,
+                                       nclass_values);
+        if (block_rows < 1)
+            block_rows = 1;
+
+        soil_reader = malloc(sizeof *soil_reader);
+        veg_reader = malloc(sizeof *veg_reader);
+        open_line_reader(soil_reader, gp->soil);
+        open_line_reader(veg_reader, gp->vegparam);
+        if (snow_bands) {
+            band_reader = malloc(sizeof *band_reader);
+            open_line_reader(band_reader, gp->snow_band->file);
+        }
+        else
+            band_reader = NULL;
+    }
+    else {
+        /* the staging buffers of the workers take no more memory than two
+         * of all rows, so the blocks are smaller with more threads */
+        block_rows = (2 * nlat + gp->threads) / (gp->threads + 1);
+        soil_reader = veg_reader = band_reader = NULL;
+    }
+    if (block_rows > nlat)
+        block_rows = nlat;
+
+    max_cells = 0;
+    for (row = 0; row < nlat; row += block_rows) {
+        rows = row + block_rows < nlat ? block_rows : nlat - row;
+        n_cells = soil->lat_cells[row + rows] - soil->lat_cells[row];
+        if (n_cells > max_cells)
+            max_cells = n_cells;
+    }
 
-        d = 0;
-        start[d++] = 0;
-        start[d++] = lat_idx =
-            find_double(soil->domain->lat, soil->cells[i]->lat);
-        start[d++] = lon_idx =
-            find_double(soil->domain->lon, soil->cells[i]->lon);
-        d = 0;
-        count[d++] = gp->nlayer;
-        count[d++] = 1;
-        count[d++] = 1;
+    /* each variable of a block is staged in its own buffer and written by
+     * the writer thread while the next ones are gathered */
+    staging_bytes = sizeof *doubles * nvalues > sizeof *ints * nclass_values ?
+        sizeof *doubles * nvalues : sizeof *ints * nclass_values;
+    init_nc_writer_s(&writer, ncid, gp->threads + 1,
+                     staging_bytes * block_rows * nlon, gp->stats != NULL);
+    for (i = 0; i < N_CLASS_INTS; i++)
+        class_ints[i] = malloc(sizeof *class_ints[i] * veg_lib->n_classes);
+    /* Ctype and NscaleFlag are only read with VEGLIB_PHOTO */
+    for (i = 0; i < veg_lib->n_classes; i++) {
+        class_ints[OVERSTORY][i] = veg_lib->classes[i]->overstory;
+        if (gp->veglib_photo) {
+            class_ints[CTYPE][i] = veg_lib->classes[i]->Ctype;
+            class_ints[NSCALE_FLAG][i] = veg_lib->classes[i]->NscaleFlag;
+        }
+    }
+    grid_idx = malloc(sizeof *grid_idx * max_cells);
+    veg_cells = malloc(sizeof *veg_cells * max_cells);
+    class_idx = malloc(sizeof *class_idx * max_cells);
+    band_cells = malloc(sizeof *band_cells * max_cells);
+
+    /* the vegetation class indices, and the cells read in streaming mode,
+     * live until the end of their block */
+    init_arena_s(&block_arena);
+
+    if (soil_reader) {
+        block_cells = alloc_soil_table(gp, max_cells);
+        veg_cell_buf = malloc(sizeof *veg_cell_buf * max_cells);
+    }
+    else {
+        block_cells = NULL;
+        veg_cell_buf = NULL;
+    }
+    if (band_reader)
+        band_cell_buf = malloc(sizeof *band_cell_buf * max_cells * 3 *
+                               snow_bands->bands);
+    else
+        band_cell_buf = NULL;
+
+    init_param_block_s(&block, gp->threads);
+    block.veg_lib = veg_lib;
+    block.writer = &writer;
+    block.timed = gp->stats != NULL;
+    block.bands = snow_bands ? snow_bands->bands : 0;
+    block.grid_idx = grid_idx;
+    block.veg_cells = veg_cells;
+    block.class_idx = class_idx;
+    block.band_cells = band_cells;
+
+    /* the stages of the variables are the time the workers spent on them,
+     * summed over the workers and including any wait for a free staging
+     * buffer while the writer thread is behind */
+    for (row = 0; row < nlat; row += block_rows) {
+        int first, base;
+
+        start_stats_timer(gp->stats, &start);
+
+        rows = row + block_rows < nlat ? block_rows : nlat - row;
+        ngrid = rows * nlon;
+        first = soil->lat_cells[row];
+        n_cells = soil->lat_cells[row + rows] - first;
+
+        /* base is the table row of the first cell in the block */
+        if (soil_reader) {
+            cells = block_cells;
+            base = 0;
+            for (i = 0; i < n_cells; i++)
+                read_soil_cell_at(gp, soil_reader, soil->offsets[first + i],
+                                  cells, i);
+        }
+        else {
+            cells = soil->cells;
+            base = first;
+        }
 
-        mask_idx = lat_idx * soil->domain->lon->n + lon_idx;
+        /* look up the grid position in the block, vegetation parameters,
+         * vegetation classes and snow bands of each cell once */
+        for (i = 0; i < n_cells; i++) {
+            int gridcel = cells->gridcel[base + i];
+            int j;
 
-        /* location variables */
-        nc_check(nc_put_var1
-                 (ncid, cellnum_varid, start + 1, &soil->cells[i]->gridcel),
-                 "Cannot put variable: cellnum\n");
-        nc_check(nc_put_var1
-                 (ncid, mask_varid, start + 1, &soil->domain->mask[mask_idx]),
-                 "Cannot put variable: mask\n");
+            grid_idx[i] = soil->grid_idx[first + i] - row * nlon;
 
-        /* soil variables */
-        nc_check(nc_put_var1(ncid, run_cell_varid, start + 1, &run_cell),
-                 "Cannot put variable: run_cell\n");
-        nc_check(nc_put_var1
-                 (ncid, gridcell_varid, start + 1, &soil->cells[i]->gridcel),
-                 "Cannot put variable: gridcell\n");
-        nc_check(nc_put_var1
-                 (ncid, lats_varid, start + 1, &soil->cells[i]->lat),
-                 "Cannot put variable: lats\n");
-        nc_check(nc_put_var1
-                 (ncid, lons_varid, start + 1, &soil->cells[i]->lon),
-                 "Cannot put variable: lons\n");
-        nc_check(nc_put_var1
-                 (ncid, infilt_varid, start + 1, &soil->cells[i]->infilt),
-                 "Cannot put variable: infilt\n");
-        nc_check(nc_put_var1(ncid, Ds_varid, start + 1, &soil->cells[i]->Ds),
-                 "Cannot put variable: Ds\n");
-        nc_check(nc_put_var1
-                 (ncid, Dsmax_varid, start + 1, &soil->cells[i]->Dsmax),
-                 "Cannot put variable: Dsmax\n");
-        nc_check(nc_put_var1(ncid, Ws_varid, start + 1, &soil->cells[i]->Ws),
-                 "Cannot put variable: Ws\n");
-        nc_check(nc_put_var1(ncid, c_varid, start + 1, &soil->cells[i]->c),
-                 "Cannot put variable: c\n");
-
-        nc_check(nc_put_vara
-                 (ncid, expt_varid, start, count, soil->cells[i]->expt),
-                 "Cannot put variable: expt\n");
-        nc_check(nc_put_vara
-                 (ncid, Ksat_varid, start, count, soil->cells[i]->Ksat),
-                 "Cannot put variable: Ksat\n");
-        nc_check(nc_put_vara
-                 (ncid, phi_s_varid, start, count, soil->cells[i]->phi_s),
-                 "Cannot put variable: phi_s\n");
-        nc_check(nc_put_vara
-                 (ncid, init_moist_varid, start, count,
-                  soil->cells[i]->init_moist),
-                 "Cannot put variable: init_moist\n");
-
-        nc_check(nc_put_var1
-                 (ncid, elev_varid, start + 1, &soil->cells[i]->elev),
-                 "Cannot put variable: elev\n");
-
-        nc_check(nc_put_vara
-                 (ncid, depth_varid, start, count, soil->cells[i]->depth),
-                 "Cannot put variable: depth\n");
-
-        nc_check(nc_put_var1
-                 (ncid, avg_T_varid, start + 1, &soil->cells[i]->avg_T),
-                 "Cannot put variable: avg_T\n");
-        nc_check(nc_put_var1(ncid, dp_varid, start + 1, &soil->cells[i]->dp),
-                 "Cannot put variable: dp\n");
-
-        nc_check(nc_put_vara
-                 (ncid, bubble_varid, start, count, soil->cells[i]->bubble),
-                 "Cannot put variable: bubble\n");
-        nc_check(nc_put_vara
-                 (ncid, quartz_varid, start, count, soil->cells[i]->quartz),
-                 "Cannot put variable: quartz\n");
-        nc_check(nc_put_vara
-                 (ncid, bulk_density_varid, start, count,
-                  soil->cells[i]->bulk_density),
-                 "Cannot put variable: bulk_density\n");
-        nc_check(nc_put_vara
-                 (ncid, soil_density_varid, start, count,
-                  soil->cells[i]->soil_density),
-                 "Cannot put variable: soil_density\n");
+            if (veg_reader) {
+                long offset = find_veg_cell_offset(veg_params, gridcel);
 
-        if (gp->organic_fract) {
-            nc_check(nc_put_vara
-                     (ncid, organic_varid, start, count,
-                      soil->cells[i]->organic),
-                     "Cannot put variable: organic\n");
-            nc_check(nc_put_vara
-                     (ncid, bulk_dens_org_varid, start, count,
-                      soil->cells[i]->bulk_dens_org),
-                     "Cannot put variable: bulk_dens_org\n");
-            nc_check(nc_put_vara
-                     (ncid, soil_dens_org_varid, start, count,
-                      soil->cells[i]->soil_dens_org),
-                     "Cannot put variable: soil_dens_org\n");
+                if (offset < 0)
+                    error
+                        ("Cannot find vegetation parameters for grid cell %d\n",
+                         gridcel);
+                read_veg_cell_at(gp, veg_reader, offset, &block_arena,
+                                 &veg_cell_buf[i]);
+                veg_cells[i] = &veg_cell_buf[i];
+            }
+            else if (!(veg_cells[i] = find_veg_cell(veg_params, gridcel)))
+                error("Cannot find vegetation parameters for grid cell %d\n",
+                      gridcel);
+
+            class_idx[i] =
+                arena_alloc(&block_arena,
+                            sizeof *class_idx[i] * veg_cells[i]->Nveg);
+
+            for (j = 0; j < veg_cells[i]->Nveg; j++)
+                if ((class_idx[i][j] =
+                     find_veg_class(veg_lib, veg_cells[i]->veg_class[j])) < 0)
+                    error
+                        ("Cannot find vegetation library for grid cell %d vegetation class %d\n",
+                         gridcel, veg_cells[i]->veg_class[j]);
+
+            if (band_reader) {
+                long offset = find_snow_band_offset(snow_bands, gridcel);
+                double *values = band_cell_buf +
+                    (size_t)i * 3 * snow_bands->bands;
+
+                if (offset < 0)
+                    error("Cannot find snow bands for grid cell %d\n",
+                          gridcel);
+                read_snow_band_cell_at(gp, band_reader, offset, values);
+                band_cells[i] = values;
+            }
+            else if (snow_bands &&
+                     !(band_cells[i] =
+                       find_snow_band_cell(snow_bands, gridcel)))
+                error("Cannot find snow bands for grid cell %d\n", gridcel);
         }
 
-        nc_check(nc_put_var1
-                 (ncid, off_gmt_varid, start + 1, &soil->cells[i]->off_gmt),
-                 "Cannot put variable: off_gmt\n");
-
-        nc_check(nc_put_vara
-                 (ncid, Wcr_FRACT_varid, start, count,
-                  soil->cells[i]->Wcr_FRACT),
-                 "Cannot put variable: Wcr_FRACT\n");
-        nc_check(nc_put_vara
-                 (ncid, Wpwp_FRACT_varid, start, count,
-                  soil->cells[i]->Wpwp_FRACT),
-                 "Cannot put variable: Wpwp_FRACT\n");
-
-        nc_check(nc_put_var1
-                 (ncid, rough_varid, start + 1, &soil->cells[i]->rough),
-                 "Cannot put variable: rough\n");
-        nc_check(nc_put_var1
-                 (ncid, snow_rough_varid, start + 1,
-                  &soil->cells[i]->snow_rough),
-                 "Cannot put variable: snow_rough\n");
-        nc_check(nc_put_var1
-                 (ncid, annual_prec_varid, start + 1,
-                  &soil->cells[i]->annual_prec),
-                 "Cannot put variable: annual_prec\n");
-
-        nc_check(nc_put_vara
-                 (ncid, resid_moist_varid, start, count,
-                  soil->cells[i]->resid_moist),
-                 "Cannot put variable: resid_moist\n");
-
-        nc_check(nc_put_var1(ncid, fs_active_varid, start + 1, &fs_active),
-                 "Cannot put variable: fs_active\n");
+        add_stats(gp->stats, soil_reader ? "params.read_cells" :
+                  "params.find_cells", &start, n_cells, 0);
 
+        /* the variables of the block are gathered by the workers and
+         * written in any order, so they are listed first */
+        block.row = row;
+        block.rows = rows;
+        block.ngrid = ngrid;
+        block.n_cells = n_cells;
+        block.nalloc = cells->nalloc;
+        block.n_added = 0;
+
+        /* location variables */
+        block.stage = LOCATION_VARS;
+        add_cell_ints(&block, cellnum_varid, "cellnum",
+                      cells->gridcel + base);
+        add_cell_ints(&block, gridcell_varid, "gridcell",
+                      cells->gridcel + base);
+        var = add_param_var(&block, GATHER_MASK, mask_varid, "mask", 1);
+        var->ints = soil->domain->mask + row * nlon;
+
+        /* soil variables */
+        block.stage = SOIL_VARS;
+        add_cell_ints(&block, run_cell_varid, "run_cell",
+                      cells->run_cell + base);
+        add_soil(&block, lats_varid, "lats", cells->lat + base, 1);
+        add_soil(&block, lons_varid, "lons", cells->lon + base, 1);
+        add_soil(&block, infilt_varid, "infilt", cells->infilt + base, 1);
+        add_soil(&block, Ds_varid, "Ds", cells->Ds + base, 1);
+        add_soil(&block, Dsmax_varid, "Dsmax", cells->Dsmax + base, 1);
+        add_soil(&block, Ws_varid, "Ws", cells->Ws + base, 1);
+        add_soil(&block, c_varid, "c", cells->c + base, 1);
+        add_soil(&block, expt_varid, "expt", cells->expt + base, gp->nlayer);
+        add_soil(&block, Ksat_varid, "Ksat", cells->Ksat + base, gp->nlayer);
+        add_soil(&block, phi_s_varid, "phi_s", cells->phi_s + base,
+                 gp->nlayer);
+        add_soil(&block, init_moist_varid, "init_moist",
+                 cells->init_moist + base, gp->nlayer);
+        add_soil(&block, elev_varid, "elev", cells->elev + base, 1);
+        add_soil(&block, depth_varid, "depth", cells->depth + base,
+                 gp->nlayer);
+        add_soil(&block, avg_T_varid, "avg_T", cells->avg_T + base, 1);
+        add_soil(&block, dp_varid, "dp", cells->dp + base, 1);
+        add_soil(&block, bubble_varid, "bubble", cells->bubble + base,
+                 gp->nlayer);
+        add_soil(&block, quartz_varid, "quartz", cells->quartz + base,
+                 gp->nlayer);
+        add_soil(&block, bulk_density_varid, "bulk_density",
+                 cells->bulk_density + base, gp->nlayer);
+        add_soil(&block, soil_density_varid, "soil_density",
+                 cells->soil_density + base, gp->nlayer);
+        if (gp->organic_fract) {
+            add_soil(&block, organic_varid, "organic", cells->organic + base,
+                     gp->nlayer);
+            add_soil(&block, bulk_dens_org_varid, "bulk_dens_org",
+                     cells->bulk_dens_org + base, gp->nlayer);
+            add_soil(&block, soil_dens_org_varid, "soil_dens_org",
+                     cells->soil_dens_org + base, gp->nlayer);
+        }
+        add_soil(&block, off_gmt_varid, "off_gmt", cells->off_gmt + base, 1);
+        add_soil(&block, Wcr_FRACT_varid, "Wcr_FRACT",
+                 cells->Wcr_FRACT + base, gp->nlayer);
+        add_soil(&block, Wpwp_FRACT_varid, "Wpwp_FRACT",
+                 cells->Wpwp_FRACT + base, gp->nlayer);
+        add_soil(&block, rough_varid, "rough", cells->rough + base, 1);
+        add_soil(&block, snow_rough_varid, "snow_rough",
+                 cells->snow_rough + base, 1);
+        add_soil(&block, annual_prec_varid, "annual_prec",
+                 cells->annual_prec + base, 1);
+        add_soil(&block, resid_moist_varid, "resid_moist",
+                 cells->resid_moist + base, gp->nlayer);
+        add_cell_ints(&block, fs_active_varid, "fs_active",
+                      cells->fs_active + base);
         if (gp->spatial_frost) {
-            nc_check(nc_put_var1
-                     (ncid, frost_slope_varid, start + 1,
-                      &soil->cells[i]->frost_slope),
-                     "Cannot put variable: frost_slope\n");
-            nc_check(nc_put_var1
-                     (ncid, max_snow_distrib_slope_varid, start + 1,
-                      &soil->cells[i]->max_snow_distrib_slope),
-                     "Cannot put variable: max_snow_distrib_slope\n");
+            add_soil(&block, frost_slope_varid, "frost_slope",
+                     cells->frost_slope + base, 1);
+            add_soil(&block, max_snow_distrib_slope_varid,
+                     "max_snow_distrib_slope",
+                     cells->max_snow_distrib_slope + base, 1);
         }
-
         if (gp->july_tavg_supplied)
-            nc_check(nc_put_var1
-                     (ncid, July_Tavg_varid, start + 1,
-                      &soil->cells[i]->July_Tavg),
-                     "Cannot put variable: July_Tavg\n");
+            add_soil(&block, July_Tavg_varid, "July_Tavg",
+                     cells->July_Tavg + base, 1);
+
+        /* snow band variables */
+        block.stage = SNOW_BAND_VARS;
+        if (snow_bands) {
+            add_snow_bands(&block, AreaFract_varid, "AreaFract", 0);
+            add_snow_bands(&block, elevation_varid, "elevation", 1);
+            add_snow_bands(&block, Pfactor_varid, "Pfactor", 2);
+        }
 
         /* vegetation variables */
-        for (vp_idx = 0;
-             vp_idx < veg_params->n_cells &&
-             veg_params->cells[vp_idx]->gridcel != soil->cells[i]->gridcel;
-             vp_idx++) ;
-        if (vp_idx == veg_params->n_cells)
-            error("Cannot find vegetation parameters for grid cell %d\n",
-                  soil->cells[i]->gridcel);
-
-        nc_check(nc_put_var1
-                 (ncid, Nveg_varid, start + 1,
-                  &veg_params->cells[vp_idx]->Nveg),
-                 "Cannot put variable: Nveg\n");
-
-        for (j = 0; j < veg_params->cells[vp_idx]->Nveg; j++) {
-            int vl_idx, overstory;
-
-            for (vl_idx = 0;
-                 vl_idx < veg_lib->n_classes &&
-                 veg_lib->classes[vl_idx]->veg_class !=
-                 veg_params->cells[vp_idx]->veg_class[j]; vl_idx++) ;
-
-            if (vl_idx == veg_lib->n_classes)
-                error
-                    ("Cannot find vegetation library for grid cell %d vegetation class %d\n",
-                     soil->cells[i]->gridcel,
-                     veg_params->cells[vp_idx]->veg_class[j]);
-
-            d = 0;
-            start[d++] = vl_idx;
-            start[d++] = lat_idx;
-            start[d++] = lon_idx;
-
-            nc_check(nc_put_var1
-                     (ncid, Cv_varid, start,
-                      &veg_params->cells[vp_idx]->Cv[j]),
-                     "Cannot put variable: Cv\n");
-
-            d = 0;
-            start[d++] = vl_idx;
-            start[d++] = 0;
-            start[d++] = lat_idx;
-            start[d++] = lon_idx;
-            d = 0;
-            count[d++] = 1;
-            count[d++] = veg_params->root_zones;
-            count[d++] = 1;
-            count[d++] = 1;
-
-            nc_check(nc_put_vara
-                     (ncid, root_depth_varid, start, count,
-                      veg_params->cells[vp_idx]->root_depth[j]),
-                     "Cannot put variable: root_depth\n");
-            nc_check(nc_put_vara
-                     (ncid, root_fract_varid, start, count,
-                      veg_params->cells[vp_idx]->root_fract[j]),
-                     "Cannot put variable: root_fract\n");
-
-            if (gp->blowing) {
-                d = 0;
-                start[d++] = vl_idx;
-                start[d++] = lat_idx;
-                start[d++] = lon_idx;
-
-                nc_check(nc_put_var1
-                         (ncid, sigma_slope_varid, start,
-                          &veg_params->cells[vp_idx]->sigma_slope[j]),
-                         "Cannot put variable: sigma_slope\n");
-                nc_check(nc_put_var1
-                         (ncid, lag_one_varid, start,
-                          &veg_params->cells[vp_idx]->lag_one[j]),
-                         "Cannot put variable: lag_one\n");
-                nc_check(nc_put_var1
-                         (ncid, fetch_varid, start,
-                          &veg_params->cells[vp_idx]->fetch[j]),
-                         "Cannot put variable: fetch\n");
-            }
+        block.stage = VEG_VARS;
+        add_param_var(&block, GATHER_NVEG, Nveg_varid, "Nveg", 1);
+        var = add_veg(&block, Cv_varid, "Cv",
+                      offsetof(struct veg_cell_s, Cv), -1, 0);
+        var->fill = double_fill;
+        if (veg_params->root_zones) {
+            add_veg(&block, root_depth_varid, "root_depth",
+                    offsetof(struct veg_cell_s, root_depth), -1,
+                    veg_params->root_zones);
+            add_veg(&block, root_fract_varid, "root_fract",
+                    offsetof(struct veg_cell_s, root_fract), -1,
+                    veg_params->root_zones);
+        }
+        if (gp->blowing) {
+            add_veg(&block, sigma_slope_varid, "sigma_slope",
+                    offsetof(struct veg_cell_s, sigma_slope), -1, 0);
+            add_veg(&block, lag_one_varid, "lag_one",
+                    offsetof(struct veg_cell_s, lag_one), -1, 0);
+            add_veg(&block, fetch_varid, "fetch",
+                    offsetof(struct veg_cell_s, fetch), -1, 0);
+        }
+        if (gp->vegparam_lai)
+            add_veg(&block, LAI_varid, "LAI", offsetof(struct veg_cell_s, LAI),
+                    -1, 12);
+        else
+            add_veg(&block, LAI_varid, "LAI", -1,
+                    offsetof(struct veg_class_s, LAI), 12);
+        /* the vegetation library overrides FCANOPY if both supply it */
+        if (gp->vegparam_fcan || gp->veglib_fcan)
+            add_veg(&block, FCANOPY_varid, "FCANOPY", gp->vegparam_fcan ?
+                    (int)offsetof(struct veg_cell_s, FCANOPY) : -1,
+                    gp->veglib_fcan ?
+                    (int)offsetof(struct veg_class_s, FCANOPY) : -1, 12);
+        if (gp->vegparam_alb)
+            add_veg(&block, albedo_varid, "albedo",
+                    offsetof(struct veg_cell_s, ALBEDO), -1, 12);
+        else
+            add_veg(&block, albedo_varid, "albedo", -1,
+                    offsetof(struct veg_class_s, albedo), 12);
+        add_veg_lib_ints(&block, overstory_varid, "overstory",
+                         class_ints[OVERSTORY]);
+        add_veg(&block, rarc_varid, "rarc", -1,
+                offsetof(struct veg_class_s, rarc), 0);
+        add_veg(&block, rmin_varid, "rmin", -1,
+                offsetof(struct veg_class_s, rmin), 0);
+        add_veg(&block, veg_rough_varid, "veg_rough", -1,
+                offsetof(struct veg_class_s, rough), 12);
+        add_veg(&block, displacement_varid, "displacement", -1,
+                offsetof(struct veg_class_s, displacement), 12);
+        add_veg(&block, wind_h_varid, "wind_h", -1,
+                offsetof(struct veg_class_s, wind_h), 0);
+        add_veg(&block, RGL_varid, "RGL", -1,
+                offsetof(struct veg_class_s, RGL), 0);
+        add_veg(&block, rad_atten_varid, "rad_atten", -1,
+                offsetof(struct veg_class_s, rad_atten), 0);
+        add_veg(&block, wind_atten_varid, "wind_atten", -1,
+                offsetof(struct veg_class_s, wind_atten), 0);
+        add_veg(&block, trunk_ratio_varid, "trunk_ratio", -1,
+                offsetof(struct veg_class_s, trunk_ratio), 0);
+        if (gp->veglib_photo) {
+            add_veg_lib_ints(&block, Ctype_varid, "Ctype", class_ints[CTYPE]);
+            add_veg(&block, MaxCarboxRate_varid, "MaxCarboxRate", -1,
+                    offsetof(struct veg_class_s, MaxCarboxRate), 0);
+            add_veg(&block, MaxETransport_varid, "MaxETransport", -1,
+                    offsetof(struct veg_class_s, MaxETransport), 0);
+            add_veg(&block, LightUseEff_varid, "LightUseEff", -1,
+                    offsetof(struct veg_class_s, LightUseEff), 0);
+            add_veg_lib_ints(&block, NscaleFlag_varid, "NscaleFlag",
+                             class_ints[NSCALE_FLAG]);
+            add_veg(&block, Wnpp_inhib_varid, "Wnpp_inhib", -1,
+                    offsetof(struct veg_class_s, Wnpp_inhib), 0);
+            add_veg(&block, NPPfactor_sat_varid, "NPPfactor_sat", -1,
+                    offsetof(struct veg_class_s, NPPfactor_sat), 0);
+        }
+
+        gather_param_block(&block);
+
+        for (i = 0; i < N_PARAM_STAGES; i++)
+            if (block.stage_vars[i])
+                add_stats_seconds(gp->stats, param_stage_names[i],
+                                  block.stage_seconds[i], n_cells, 0);
+
+        reset_arena_s(&block_arena);
+    }
+
+    free_param_block_s(&block);
+
+    start_stats_timer(gp->stats, &start);
+    free_nc_writer_s(&writer);
+    add_stats(gp->stats, "params.write_wait", &start, 0, 0);
+    add_stats_seconds(gp->stats, "params.write", writer.put_seconds, 0,
+                      writer.put_bytes);
+
+    start_stats_timer(gp->stats, &start);
+    nc_check(nc_close(ncid), "Cannot close file: %s\n", gp->parameters);
+    add_stats(gp->stats, "params.close", &start, 0, 0);
+
+    if (soil_reader) {
+        close_line_reader(soil_reader);
+        close_line_reader(veg_reader);
+        free(soil_reader);
+        free(veg_reader);
+        free_soil_table(block_cells);
+    }
+    if (band_reader) {
+        close_line_reader(band_reader);
+        free(band_reader);
+    }
+    free(band_cell_buf);
+    free(band_cells);
+    free_arena_s(&block_arena);
+    free(veg_cell_buf);
+    free(class_idx);
+    free(veg_cells);
+    free(grid_idx);
+    for (i = 0; i < N_CLASS_INTS; i++)
+        free(class_ints[i]);
+}
 
-            d = 0;
-            start[d++] = vl_idx;
-            start[d++] = 0;
-            start[d++] = lat_idx;
-            start[d++] = lon_idx;
-            d = 0;
-            count[d++] = 1;
-            count[d++] = 12;
-            count[d++] = 1;
-            count[d++] = 1;
-
-            if (gp->vegparam_lai)
-                nc_check(nc_put_vara
-                         (ncid, LAI_varid, start, count,
-                          veg_params->cells[vp_idx]->LAI[j]),
-                         "Cannot put variable: LAI\n");
-
-            if (gp->vegparam_fcan)
-                nc_check(nc_put_vara
-                         (ncid, FCANOPY_varid, start, count,
-                          veg_params->cells[vp_idx]->FCANOPY[j]),
-                         "Cannot put variable: FCANOPY\n");
-
-            if (gp->vegparam_alb)
-                nc_check(nc_put_vara
-                         (ncid, albedo_varid, start, count,
-                          veg_params->cells[vp_idx]->ALBEDO[j]),
-                         "Cannot put variable: albedo\n");
-
-
-            d = 0;
-            start[d++] = vl_idx;
-            start[d++] = lat_idx;
-            start[d++] = lon_idx;
-
-            overstory = veg_lib->classes[vl_idx]->overstory;
-            nc_check(nc_put_var1
-                     (ncid, overstory_varid, start, &overstory),
-                     "Cannot put variable: overstory\n");
-            nc_check(nc_put_var1
-                     (ncid, rarc_varid, start,
-                      &veg_lib->classes[vl_idx]->rarc),
-                     "Cannot put variable: rarc\n");
-            nc_check(nc_put_var1
-                     (ncid, rmin_varid, start,
-                      &veg_lib->classes[vl_idx]->rmin),
-                     "Cannot put variable: rmin\n");
-
-            d = 0;
-            start[d++] = vl_idx;
-            start[d++] = 0;
-            start[d++] = lat_idx;
-            start[d++] = lon_idx;
-            d = 0;
-            count[d++] = 1;
-            count[d++] = 12;
-            count[d++] = 1;
-            count[d++] = 1;
-
-            if (!gp->vegparam_lai)
-                nc_check(nc_put_vara
-                         (ncid, LAI_varid, start, count,
-                          veg_lib->classes[vl_idx]->LAI),
-                         "Cannot put variable: LAI\n");
-
-            if (gp->veglib_fcan)
-                nc_check(nc_put_vara
-                         (ncid, FCANOPY_varid, start, count,
-                          veg_lib->classes[vl_idx]->FCANOPY),
-                         "Cannot put variable: FCANOPY\n");
-
-            if (!gp->vegparam_alb)
-                nc_check(nc_put_vara
-                         (ncid, albedo_varid, start, count,
-                          veg_lib->classes[vl_idx]->albedo),
-                         "Cannot put variable: albedo\n");
-            nc_check(nc_put_vara
-                     (ncid, veg_rough_varid, start, count,
-                      veg_lib->classes[vl_idx]->rough),
-                     "Cannot put variable: veg_rough\n");
-            nc_check(nc_put_vara
-                     (ncid, displacement_varid, start, count,
-                      veg_lib->classes[vl_idx]->displacement),
-                     "Cannot put variable: displacement\n");
-
-            d = 0;
-            start[d++] = vl_idx;
-            start[d++] = lat_idx;
-            start[d++] = lon_idx;
-            nc_check(nc_put_var1
-                     (ncid, wind_h_varid, start,
-                      &veg_lib->classes[vl_idx]->wind_h),
-                     "Cannot put variable: wind_h\n");
-            nc_check(nc_put_var1
-                     (ncid, RGL_varid, start,
-                      &veg_lib->classes[vl_idx]->RGL),
-                     "Cannot put variable: RGL\n");
-            nc_check(nc_put_var1
-                     (ncid, rad_atten_varid, start,
-                      &veg_lib->classes[vl_idx]->rad_atten),
-                     "Cannot put variable: rad_atten\n");
-            nc_check(nc_put_var1
-                     (ncid, wind_atten_varid, start,
-                      &veg_lib->classes[vl_idx]->wind_atten),
-                     "Cannot put variable: wind_atten\n");
-            nc_check(nc_put_var1
-                     (ncid, trunk_ratio_varid, start,
-                      &veg_lib->classes[vl_idx]->trunk_ratio),
-                     "Cannot put variable: trunk_ratio\n");
-
-            if (gp->veglib_photo) {
-                int NscaleFlag = veg_lib->classes[vl_idx]->NscaleFlag;
-
-                nc_check(nc_put_var1
-                         (ncid, Ctype_varid, start,
-                          &veg_lib->classes[vl_idx]->Ctype),
-                         "Cannot put variable: Ctype\n");
-                nc_check(nc_put_var1
-                         (ncid, MaxCarboxRate_varid, start,
-                          &veg_lib->classes[vl_idx]->MaxCarboxRate),
-                         "Cannot put variable: MaxCarboxRate\n");
-                nc_check(nc_put_var1
-                         (ncid, MaxETransport_varid, start,
-                          &veg_lib->classes[vl_idx]->MaxETransport),
-                         "Cannot put variable: MaxETransport\n");
-                nc_check(nc_put_var1
-                         (ncid, LightUseEff_varid, start,
-                          &veg_lib->classes[vl_idx]->LightUseEff),
-                         "Cannot put variable: LightUseEff\n");
-                nc_check(nc_put_var1
-                         (ncid, NscaleFlag_varid, start, &NscaleFlag),
-                         "Cannot put variable: NscaleFlag\n");
-                nc_check(nc_put_var1
-                         (ncid, Wnpp_inhib_varid, start,
-                          &veg_lib->classes[vl_idx]->Wnpp_inhib),
-                         "Cannot put variable: Wnpp_inhib\n");
-                nc_check(nc_put_var1
-                         (ncid, NPPfactor_sat_varid, start,
-                          &veg_lib->classes[vl_idx]->NPPfactor_sat),
-                         "Cannot put variable: NPPfactor_sat\n");
+/* an upper bound of the size of the variables of the parameters file */
+static size_t params_bytes(struct global_params_s *gp,
+                           struct veg_lib_s *veg_lib, struct domain_s *domain)
+{
+    size_t cell_values, class_values;
+
+    /* the cell values are the soil ones and Nveg; a class has at most 80
+     * values besides its root zones */
+    cell_values = 21 + gp->nlayer * 15 + gp->snow_band->bands * 3;
+    class_values = 80 + gp->root_zones * 2;
+
+    return sizeof(double) * domain->lat->n * domain->lon->n *
+        (cell_values + veg_lib->n_classes * class_values);
+}
+
+/* estimate the memory needed to stage and parse one lat row of nlon cells */
+static size_t row_bytes(struct global_params_s *gp, struct veg_lib_s *veg_lib,
+                        size_t nlon, int nvalues, int nclass_values)
+{
+    size_t staging, soil_cell, veg_cell, band_cell;
+
+    /* a buffer per worker and one being written */
+    staging = (gp->threads + 1) *
+        (sizeof(double) * nvalues > sizeof(int) * nclass_values ?
+         sizeof(double) * nvalues : sizeof(int) * nclass_values);
+    soil_cell = sizeof(int) * 3 + sizeof(double) * (20 + gp->nlayer * 15);
+    /* every class may be a tile */
+    veg_cell = sizeof(struct veg_cell_s) + veg_lib->n_classes *
+        (sizeof(int) * 2 + sizeof(double) * (4 + gp->root_zones * 2 + 12 * 3)
+         + sizeof(double *) * 5);
+    band_cell = gp->snow_band && gp->snow_band->file ?
+        sizeof(double) * 3 * gp->snow_band->bands : 0;
+
+    return nlon * (staging + soil_cell + veg_cell + band_cell +
+                   sizeof(int) * 2 + sizeof(void *) * 3);
+}
+
+static void init_param_block_s(struct param_block_s *block, int threads)
+{
+    int i;
+
+    block->n_vars = block->next_var = block->n_done = block->quit = 0;
+    pthread_mutex_init(&block->lock, NULL);
+    pthread_cond_init(&block->cond, NULL);
+
+    /* the calling thread is a worker too */
+    block->n_workers = threads - 1;
+    block->workers = malloc(sizeof *block->workers * threads);
+    for (i = 0; i < block->n_workers; i++)
+        if (pthread_create(&block->workers[i], NULL, run_param_worker, block))
+            error("Cannot create thread\n");
+}
+
+static void free_param_block_s(struct param_block_s *block)
+{
+    int i;
+
+    pthread_mutex_lock(&block->lock);
+    block->quit = 1;
+    pthread_cond_broadcast(&block->cond);
+    pthread_mutex_unlock(&block->lock);
+    for (i = 0; i < block->n_workers; i++)
+        pthread_join(block->workers[i], NULL);
+
+    pthread_mutex_destroy(&block->lock);
+    pthread_cond_destroy(&block->cond);
+    free(block->workers);
+}
+
+/* list a variable of the current stage to gather into nvalues values per
+ * grid cell of the block */
+static struct param_var_s *add_param_var(struct param_block_s *block,
+                                         enum gather_kind kind, int varid,
+                                         const char *name, size_t nvalues)
+{
+    struct param_var_s *var;
+
+    if (block->n_added == MAX_PARAM_VARS)
+        error("Too many parameter variables\n");
+
+    var = &block->vars[block->n_added++];
+    var->kind = kind;
+    var->stage = block->stage;
+    var->varid = varid;
+    var->name = name;
+    var->nvalues = nvalues;
+    var->fill = NC_FILL_DOUBLE;
+    var->ints = NULL;
+    var->field = NULL;
+    var->count = 0;
+    var->veg_params_offset = var->veg_lib_offset = -1;
+
+    return var;
+}
+
+static void add_cell_ints(struct param_block_s *block, int varid,
+                          const char *name, const int *ints)
+{
+    add_param_var(block, GATHER_CELL_INTS, varid, name, 1)->ints = ints;
+}
+
+static void add_soil(struct param_block_s *block, int varid, const char *name,
+                     const double *field, int nlayer)
+{
+    struct param_var_s *var = add_param_var(block, GATHER_SOIL, varid, name,
+                                            nlayer);
+
+    var->field = field;
+    var->count = nlayer;
+}
+
+static void add_snow_bands(struct param_block_s *block, int varid,
+                           const char *name, int k)
+{
+    add_param_var(block, GATHER_SNOW_BANDS, varid, name,
+                  block->bands)->count = k;
+}
+
+/* a [veg_class][n][lat][lon] variable from the vegetation parameters at
+ * veg_params_offset, then from the library at veg_lib_offset, either of
+ * which may be -1 */
+static struct param_var_s *add_veg(struct param_block_s *block, int varid,
+                                   const char *name, int veg_params_offset,
+                                   int veg_lib_offset, int n)
+{
+    struct param_var_s *var =
+        add_param_var(block, GATHER_VEG, varid, name,
+                      (size_t)block->veg_lib->n_classes * (n ? n : 1));
+
+    var->count = n;
+    var->veg_params_offset = veg_params_offset;
+    var->veg_lib_offset = veg_lib_offset;
+
+    return var;
+}
+
+static void add_veg_lib_ints(struct param_block_s *block, int varid,
+                             const char *name, const int *class_values)
+{
+    add_param_var(block, GATHER_VEG_LIB_INTS, varid, name,
+                  block->veg_lib->n_classes)->ints = class_values;
+}
+
+/* gather and queue the listed variables of the block with the workers and
+ * wait for them; the writer thread may still be writing them */
+static void gather_param_block(struct param_block_s *block)
+{
+    int i;
+
+    pthread_mutex_lock(&block->lock);
+    for (i = 0; i < N_PARAM_STAGES; i++) {
+        block->stage_vars[i] = 0;
+        block->stage_seconds[i] = 0;
+    }
+    for (i = 0; i < block->n_added; i++)
+        block->stage_vars[block->vars[i].stage]++;
+    block->n_vars = block->n_added;
+    block->next_var = block->n_done = 0;
+    pthread_cond_broadcast(&block->cond);
+    pthread_mutex_unlock(&block->lock);
+
+    while ((i = take_param_var(block, 0)) >= 0)
+        gather_param_var(block, &block->vars[i]);
+
+    pthread_mutex_lock(&block->lock);
+    while (block->n_done < block->n_vars)
+        pthread_cond_wait(&block->cond, &block->lock);
+    pthread_mutex_unlock(&block->lock);
+}
+
+static void *run_param_worker(void *arg)
+{
+    struct param_block_s *block = arg;
+    int i;
+
+    while ((i = take_param_var(block, 1)) >= 0)
+        gather_param_var(block, &block->vars[i]);
+
+    return NULL;
+}
+
+/* the index of the next variable to gather, or -1 if there is none; a
+ * worker waits for the next block until the pool is freed */
+static int take_param_var(struct param_block_s *block, int wait)
+{
+    int i = -1;
+
+    pthread_mutex_lock(&block->lock);
+    while (wait && block->next_var == block->n_vars && !block->quit)
+        pthread_cond_wait(&block->cond, &block->lock);
+    if (block->next_var < block->n_vars)
+        i = block->next_var++;
+    pthread_mutex_unlock(&block->lock);
+
+    return i;
+}
+
+/* fill a free staging buffer with the variable and queue it for writing */
+static void gather_param_var(struct param_block_s *block,
+                             struct param_var_s *var)
+{
+    struct timespec start, end;
+    size_t ngrid = block->ngrid, n = ngrid * var->nvalues;
+    int *ints = NULL;
+    double *doubles = NULL;
+    double seconds = 0;
+    int i;
+
+    if (block->timed)
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (var->kind == GATHER_SOIL || var->kind == GATHER_SNOW_BANDS ||
+        var->kind == GATHER_VEG) {
+        doubles = take_nc_buffer(block->writer);
+        fill_doubles(doubles, n, var->fill);
+    }
+    else {
+        ints = take_nc_buffer(block->writer);
+        fill_ints(ints, n, NC_FILL_INT);
+    }
+
+    switch (var->kind) {
+    case GATHER_CELL_INTS:
+        for (i = 0; i < block->n_cells; i++)
+            ints[block->grid_idx[i]] = var->ints[i];
+        break;
+    case GATHER_MASK:
+        for (i = 0; i < block->n_cells; i++)
+            ints[block->grid_idx[i]] = var->ints[block->grid_idx[i]];
+        break;
+    case GATHER_SOIL:
+        gather_soil(var->field, block->nalloc, block->n_cells,
+                    block->grid_idx, ngrid, var->count, doubles);
+        break;
+    case GATHER_SNOW_BANDS:
+        gather_snow_bands(block->n_cells, block->band_cells, block->grid_idx,
+                          ngrid, block->bands, var->count, doubles);
+        break;
+    case GATHER_NVEG:
+        for (i = 0; i < block->n_cells; i++)
+            ints[block->grid_idx[i]] = block->veg_cells[i]->Nveg;
+        break;
+    case GATHER_VEG:
+        if (var->veg_params_offset >= 0)
+            gather_veg_params(block->n_cells, block->veg_cells,
+                              block->class_idx, block->grid_idx, ngrid,
+                              var->veg_params_offset, var->count, doubles);
+        if (var->veg_lib_offset >= 0)
+            gather_veg_lib(block->n_cells, block->veg_lib, block->veg_cells,
+                           block->class_idx, block->grid_idx, ngrid,
+                           var->veg_lib_offset, var->count, doubles);
+        break;
+    case GATHER_VEG_LIB_INTS:
+        gather_veg_lib_ints(block->n_cells, block->veg_cells,
+                            block->class_idx, block->grid_idx, ngrid,
+                            var->ints, ints);
+        break;
+    }
+
+    write_nc_rows(block->writer, var->varid, block->row, block->rows,
+                  doubles ? (void *)doubles : (void *)ints, var->name);
+
+    if (block->timed) {
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        seconds = end.tv_sec - start.tv_sec +
+            (end.tv_nsec - start.tv_nsec) / 1e9;
+    }
+
+    pthread_mutex_lock(&block->lock);
+    block->stage_seconds[var->stage] += seconds;
+    if (++block->n_done == block->n_vars)
+        pthread_cond_broadcast(&block->cond);
+    pthread_mutex_unlock(&block->lock);
+}
+
+static void fill_ints(int *values, size_t n, int fill)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        values[i] = fill;
+}
+
+static void fill_doubles(double *values, size_t n, double fill)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        values[i] = fill;
+}
+
+/* scatter nlayer layers of a soil table field with the given stride into
+ * [nlayer][lat][lon] */
+static void gather_soil(const double *field, int stride, int n_cells,
+                        const int *grid_idx, size_t ngrid, int nlayer,
+                        double *values)
+{
+    int i, j;
+
+    for (j = 0; j < nlayer; j++)
+        for (i = 0; i < n_cells; i++)
+            values[j * ngrid + grid_idx[i]] = field[(size_t)j * stride + i];
+}
+
+/* scatter the bands values starting at bands * k of each cell into
+ * [snow_band][lat][lon] */
+static void gather_snow_bands(int n_cells, const double **band_cells,
+                              const int *grid_idx, size_t ngrid, int bands,
+                              int k, double *values)
+{
+    int i, j;
+
+    for (j = 0; j < bands; j++)
+        for (i = 0; i < n_cells; i++)
+            values[j * ngrid + grid_idx[i]] = band_cells[i][k * bands + j];
+}
+
+/* scatter the per-tile vegetation parameter at offset into
+ * [veg_class][n][lat][lon]; the field is a double * indexed by tile if n is
+ * 0, or else a double ** of n values per tile */
+static void gather_veg_params(int n_cells, struct veg_cell_s **veg_cells,
+                              int **class_idx, const int *grid_idx,
+                              size_t ngrid, size_t offset, int n,
+                              double *values)
+{
+    int i, j, k;
+
+    for (i = 0; i < n_cells; i++) {
+        char *cell = (char *)veg_cells[i];
+
+        for (j = 0; j < veg_cells[i]->Nveg; j++) {
+            size_t idx = (size_t)class_idx[i][j] * (n ? n : 1);
+
+            if (n) {
+                double *field = (*(double ***)(cell + offset))[j];
+
+                for (k = 0; k < n; k++)
+                    values[(idx + k) * ngrid + grid_idx[i]] = field[k];
             }
+            else
+                values[idx * ngrid + grid_idx[i]] =
+                    (*(double **)(cell + offset))[j];
         }
     }
+}
 
-    nc_check(nc_close(ncid), "Cannot close file: %s\n", gp->parameters);
+/* scatter the vegetation library field at offset into
+ * [veg_class][n][lat][lon] for every tile; the field is a double if n is 0,
+ * or else a double * of n values */
+static void gather_veg_lib(int n_cells, struct veg_lib_s *veg_lib,
+                           struct veg_cell_s **veg_cells, int **class_idx,
+                           const int *grid_idx, size_t ngrid, size_t offset,
+                           int n, double *values)
+{
+    int i, j, k;
+
+    for (i = 0; i < n_cells; i++)
+        for (j = 0; j < veg_cells[i]->Nveg; j++) {
+            char *class = (char *)veg_lib->classes[class_idx[i][j]];
+            size_t idx = (size_t)class_idx[i][j] * (n ? n : 1);
+
+            if (n) {
+                double *field = *(double **)(class + offset);
+
+                for (k = 0; k < n; k++)
+                    values[(idx + k) * ngrid + grid_idx[i]] = field[k];
+            }
+            else
+                values[idx * ngrid + grid_idx[i]] =
+                    *(double *)(class + offset);
+        }
+}
+
+/* scatter one int per vegetation class into [veg_class][lat][lon] for every
+ * tile */
+static void gather_veg_lib_ints(int n_cells, struct veg_cell_s **veg_cells,
+                                int **class_idx, const int *grid_idx,
+                                size_t ngrid, const int *class_values,
+                                int *values)
+{
+    int i, j;
+
+    for (i = 0; i < n_cells; i++)
+        for (j = 0; j < veg_cells[i]->Nveg; j++)
+            values[(size_t)class_idx[i][j] * ngrid + grid_idx[i]] =
+                class_values[class_idx[i][j]];
 }
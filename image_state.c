@@ -0,0 +1,732 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netcdf.h>
+#include "global.h"
+#include "arena.h"
+#include "double_stack.h"
+#include "gridcel_index.h"
+#include "line_reader.h"
+#include "parser.h"
+#include "vic.h"
+#include "stats.h"
+
+/* frost subareas of each layer with SPATIAL_FROST */
+#define FROST_SUBAREAS 3
+
+/* a classic state file starts with the state date, year month day and, since
+ * VIC 5, sec, and with nlayer and nnode; binary files hold them as ints and
+ * size_ts. Each cell then has cellnum, Nveg, Nbands, in binary a size_t
+ * count of the bytes that follow, dz_node[nnode] and Zsum_node[nnode], and
+ * for each of the Nveg + 1 tiles, the last one bare soil, and each band, veg
+ * and band followed by the values of state_vars. ASCII files have a line
+ * per cell and per tile and band */
+
+enum state_type
+{
+    STATE_DOUBLE,
+    STATE_UINT,                 /* snow age in steps */
+    STATE_CHAR                  /* melting flag */
+};
+
+enum state_count
+{
+    ONE,
+    LAYERS,
+    LAYERS_FROST,
+    NODES
+};
+
+/* the image driver names of the values of a tile, in the order classic VIC
+ * writes them; canopy water and NPP only exist for vegetated tiles */
+struct state_var_s
+{
+    const char *name;
+    enum state_type type;
+    enum state_count count;
+    bool vegetated;
+    bool carbon;
+};
+
+static const struct state_var_s state_vars[] = {
+    {"STATE_SOIL_MOISTURE", STATE_DOUBLE, LAYERS, false, false},
+    {"STATE_SOIL_ICE", STATE_DOUBLE, LAYERS_FROST, false, false},
+    {"STATE_CANOPY_WATER", STATE_DOUBLE, ONE, true, false},
+    {"STATE_ANNUALNPP", STATE_DOUBLE, ONE, true, true},
+    {"STATE_ANNUALNPPPREV", STATE_DOUBLE, ONE, true, true},
+    {"STATE_CLITTER", STATE_DOUBLE, ONE, false, true},
+    {"STATE_CINTER", STATE_DOUBLE, ONE, false, true},
+    {"STATE_CSLOW", STATE_DOUBLE, ONE, false, true},
+    {"STATE_SNOW_AGE", STATE_UINT, ONE, false, false},
+    {"STATE_SNOW_MELT_STATE", STATE_CHAR, ONE, false, false},
+    {"STATE_SNOW_COVERAGE", STATE_DOUBLE, ONE, false, false},
+    {"STATE_SNOW_WATER_EQUIVALENT", STATE_DOUBLE, ONE, false, false},
+    {"STATE_SNOW_SURF_TEMP", STATE_DOUBLE, ONE, false, false},
+    {"STATE_SNOW_SURF_WATER", STATE_DOUBLE, ONE, false, false},
+    {"STATE_SNOW_PACK_TEMP", STATE_DOUBLE, ONE, false, false},
+    {"STATE_SNOW_PACK_WATER", STATE_DOUBLE, ONE, false, false},
+    {"STATE_SNOW_DENSITY", STATE_DOUBLE, ONE, false, false},
+    {"STATE_SNOW_COLD_CONTENT", STATE_DOUBLE, ONE, false, false},
+    {"STATE_SNOW_CANOPY", STATE_DOUBLE, ONE, false, false},
+    {"STATE_SOIL_NODE_TEMP", STATE_DOUBLE, NODES, false, false},
+    {"STATE_FOLIAGE_TEMPERATURE", STATE_DOUBLE, ONE, false, false},
+    {"STATE_ENERGY_LONGUNDEROUT", STATE_DOUBLE, ONE, false, false},
+    {"STATE_ENERGY_SNOW_FLUX", STATE_DOUBLE, ONE, false, false}
+};
+
+#define N_STATE_VARS (int)(sizeof state_vars / sizeof *state_vars)
+
+/* the classic state file of gp->init_state */
+struct state_s
+{
+    struct global_params_s *gp;
+    struct soil_s *soil;
+    struct veg_lib_s *veg_lib;
+    struct veg_params_s *veg_params;
+    const char *path;
+    bool binary;
+    struct line_reader_s reader;        /* ASCII */
+    struct parser_s parser;
+    int fd;                     /* binary */
+    size_t next;                /* binary: offset of the next cell */
+    unsigned char *record;      /* binary: the rest of a cell */
+    size_t record_size;
+    int date[4];                /* year, month, day and sec */
+    int nnode, nfrost, nbands, nclasses;
+    int counts[N_STATE_VARS];   /* values of each variable in a tile; 0 if
+                                 * not in the file */
+    long *offsets;              /* record of each soil cell; -1 if none */
+};
+
+/* a cell record as it is read */
+struct state_cell_s
+{
+    int gridcel;
+    int Nveg;
+    size_t Nbands;
+    size_t Nbytes;              /* binary */
+    const unsigned char *p;     /* binary: next value */
+};
+
+static void read_state_header(struct state_s *);
+static void scan_state(struct state_s *);
+static int read_cell_header(struct state_s *, struct state_cell_s *);
+static size_t tile_bytes(struct state_s *, bool);
+static size_t cell_bytes(struct state_s *, int);
+static void read_cell(struct state_s *, int, int, size_t, double **,
+                      double *, struct arena_s *, struct line_reader_s *);
+static double read_value(struct state_s *, struct state_cell_s *,
+                         enum state_type);
+static int *tile_classes(struct state_s *, int, int, struct arena_s *,
+                         struct line_reader_s *);
+static size_t state_type_size(enum state_type);
+static void fill_doubles(double *, size_t, double);
+
+/* convert the classic state file of INIT_STATE into an image state file of
+ * the date it holds; the file is scanned once for the offset of each cell
+ * and each block of lat rows is then read and written as one slab per
+ * variable; all rows make up one block unless gp->max_memory is set */
+void create_image_state(struct global_params_s *gp, struct soil_s *soil,
+                        struct veg_lib_s *veg_lib,
+                        struct veg_params_s *veg_params)
+{
+    struct state_s s;
+    struct domain_s *domain = soil->domain;
+    struct line_reader_s *veg_reader = NULL;
+    struct arena_s block_arena;
+    struct timespec start;
+    size_t nlat = domain->lat->n, nlon = domain->lon->n;
+    size_t row, rows, block_rows, tile_values = 0, cell_values;
+    char path[BUF_SIZE], units[BUF_SIZE];
+    const char *calendar = calendar_name(gp->calendar);
+    int ncid, lat_dimid, lon_dimid, time_dimid, veg_dimid, band_dimid;
+    int layer_dimid, frost_dimid, node_dimid, lat_varid, lon_varid;
+    int time_varid, dz_node_varid, node_depth_varid;
+    int varids[N_STATE_VARS];
+    double *values[N_STATE_VARS], *nodes, zero = 0;
+    int i, v;
+
+    if (!gp->init_state)
+        error("INIT_STATE is not set\n");
+    if (gp->lakes)
+        error("Lake states cannot be converted: %s\n", gp->init_state);
+
+    s.gp = gp;
+    s.soil = soil;
+    s.veg_lib = veg_lib;
+    s.veg_params = veg_params;
+    s.path = gp->init_state;
+    s.binary = gp->state_format == BINARY;
+    s.nnode = gp->nodes;
+    s.nfrost = gp->spatial_frost ? FROST_SUBAREAS : 1;
+    s.nbands = gp->snow_band->bands > 1 ? gp->snow_band->bands : 1;
+    s.nclasses = veg_lib->n_classes;
+    for (v = 0; v < N_STATE_VARS; v++) {
+        switch (state_vars[v].count) {
+        case LAYERS:
+            s.counts[v] = gp->nlayer;
+            break;
+        case LAYERS_FROST:
+            s.counts[v] = gp->nlayer * s.nfrost;
+            break;
+        case NODES:
+            s.counts[v] = s.nnode;
+            break;
+        default:
+            s.counts[v] = 1;
+        }
+        if (state_vars[v].carbon && !gp->carbon)
+            s.counts[v] = 0;
+        tile_values += s.counts[v];
+    }
+    cell_values = (size_t)s.nclasses * s.nbands * tile_values +
+        2 * s.nnode;
+
+    start_stats_timer(gp->stats, &start);
+    if (s.binary) {
+        if ((s.fd = open(s.path, O_RDONLY)) < 0)
+            error("Cannot open file: %s\n", s.path);
+        s.record = NULL;
+        s.record_size = 0;
+    }
+    else {
+        open_line_reader(&s.reader, s.path);
+        init_parser_s(&s.parser, &s.reader);
+    }
+    read_state_header(&s);
+    scan_state(&s);
+    add_stats(gp->stats, "state.scan", &start, soil->n_cells,
+              stats_file_size(gp->stats, s.path));
+
+    if (gp->max_memory) {
+        block_rows = gp->max_memory / (sizeof(double) * nlon * cell_values);
+        if (block_rows < 1)
+            block_rows = 1;
+        if (!veg_params->cells) {
+            veg_reader = malloc(sizeof *veg_reader);
+            open_line_reader(veg_reader, gp->vegparam);
+        }
+    }
+    else
+        block_rows = nlat;
+    if (block_rows > nlat)
+        block_rows = nlat;
+
+    /* state files are named as the image driver names them */
+    if (snprintf(path, BUF_SIZE, "%s.%04d%02d%02d_%05d.nc", gp->image_state,
+                 s.date[0], s.date[1], s.date[2], s.date[3]) >= BUF_SIZE)
+        error("Path too long: %s\n", gp->image_state);
+
+    start_stats_timer(gp->stats, &start);
+    nc_check(nc_create(path, image_create_mode(gp, sizeof(double) *
+                                               cell_values * nlat * nlon),
+                       &ncid),
+             "Cannot create file: %s\n", path);
+
+    nc_check(nc_def_dim(ncid, "time", 1, &time_dimid),
+             "Cannot define dimension: time\n");
+    nc_check(nc_def_dim(ncid, "lat", nlat, &lat_dimid),
+             "Cannot define dimension: lat\n");
+    nc_check(nc_def_dim(ncid, "lon", nlon, &lon_dimid),
+             "Cannot define dimension: lon\n");
+    nc_check(nc_def_dim(ncid, "veg_class", s.nclasses, &veg_dimid),
+             "Cannot define dimension: veg_class\n");
+    nc_check(nc_def_dim(ncid, "snow_band", s.nbands, &band_dimid),
+             "Cannot define dimension: snow_band\n");
+    nc_check(nc_def_dim(ncid, "nlayer", gp->nlayer, &layer_dimid),
+             "Cannot define dimension: nlayer\n");
+    nc_check(nc_def_dim(ncid, "frost_area", s.nfrost, &frost_dimid),
+             "Cannot define dimension: frost_area\n");
+    nc_check(nc_def_dim(ncid, "soil_node", s.nnode, &node_dimid),
+             "Cannot define dimension: soil_node\n");
+
+    nc_check(nc_def_var(ncid, "time", NC_DOUBLE, 1, &time_dimid,
+                        &time_varid), "Cannot define variable: time\n");
+    sprintf(units, "days since %04d-%02d-%02d %02d:%02d:%02d", s.date[0],
+            s.date[1], s.date[2], s.date[3] / 3600, s.date[3] / 60 % 60,
+            s.date[3] % 60);
+    nc_check(nc_put_att_text(ncid, time_varid, "units", strlen(units),
+                             units), "Cannot put attribute: time\n");
+    nc_check(nc_put_att_text(ncid, time_varid, "calendar", strlen(calendar),
+                             calendar), "Cannot put attribute: time\n");
+    nc_check(nc_def_var(ncid, "lat", NC_DOUBLE, 1, &lat_dimid, &lat_varid),
+             "Cannot define variable: lat\n");
+    nc_check(nc_def_var(ncid, "lon", NC_DOUBLE, 1, &lon_dimid, &lon_varid),
+             "Cannot define variable: lon\n");
+
+    {
+        int dimids[] = { node_dimid, lat_dimid, lon_dimid };
+
+        nc_check(nc_def_var(ncid, "dz_node", NC_DOUBLE, 3, dimids,
+                            &dz_node_varid),
+                 "Cannot define variable: dz_node\n");
+        nc_check(nc_def_var(ncid, "node_depth", NC_DOUBLE, 3, dimids,
+                            &node_depth_varid),
+                 "Cannot define variable: node_depth\n");
+    }
+
+    for (v = 0; v < N_STATE_VARS; v++) {
+        int dimids[6] = { veg_dimid, band_dimid }, d = 2;
+
+        if (!s.counts[v])
+            continue;
+        if (state_vars[v].count == LAYERS ||
+            state_vars[v].count == LAYERS_FROST)
+            dimids[d++] = layer_dimid;
+        if (state_vars[v].count == LAYERS_FROST)
+            dimids[d++] = frost_dimid;
+        if (state_vars[v].count == NODES)
+            dimids[d++] = node_dimid;
+        dimids[d++] = lat_dimid;
+        dimids[d++] = lon_dimid;
+
+        nc_check(nc_def_var(ncid, state_vars[v].name,
+                            state_vars[v].type == STATE_DOUBLE ? NC_DOUBLE :
+                            NC_INT, d, dimids, &varids[v]),
+                 "Cannot define variable: %s\n", state_vars[v].name);
+    }
+
+    chunk_image_vars(gp, ncid, lat_dimid, lon_dimid);
+
+    nc_check(nc_enddef(ncid), "Cannot end definition\n");
+
+    nc_check(nc_put_var_double(ncid, time_varid, &zero),
+             "Cannot put variable: time\n");
+    nc_check(nc_put_var_double(ncid, lat_varid, domain->lat->values),
+             "Cannot put variable: lat\n");
+    nc_check(nc_put_var_double(ncid, lon_varid, domain->lon->values),
+             "Cannot put variable: lon\n");
+    add_stats(gp->stats, "state.define", &start, 0, 0);
+
+    for (v = 0; v < N_STATE_VARS; v++)
+        values[v] = malloc(sizeof *values[v] * s.nclasses * s.nbands *
+                           s.counts[v] * block_rows * nlon);
+    nodes = malloc(sizeof *nodes * 2 * s.nnode * block_rows * nlon);
+    init_arena_s(&block_arena);
+
+    for (row = 0; row < nlat; row += block_rows) {
+        size_t ngrid, start_idx[3] = { 0 }, count[3];
+        int first, n_cells;
+
+        rows = row + block_rows < nlat ? block_rows : nlat - row;
+        ngrid = rows * nlon;
+        first = soil->lat_cells[row];
+        n_cells = soil->lat_cells[row + rows] - first;
+
+        start_stats_timer(gp->stats, &start);
+        for (v = 0; v < N_STATE_VARS; v++)
+            fill_doubles(values[v], (size_t)s.nclasses * s.nbands *
+                         s.counts[v] * ngrid,
+                         state_vars[v].type == STATE_DOUBLE ?
+                         NC_FILL_DOUBLE : NC_FILL_INT);
+        fill_doubles(nodes, 2 * s.nnode * ngrid, NC_FILL_DOUBLE);
+
+        for (i = 0; i < n_cells; i++)
+            if (s.offsets[first + i] >= 0)
+                read_cell(&s, first + i,
+                          soil->grid_idx[first + i] - row * nlon, ngrid,
+                          values, nodes, &block_arena, veg_reader);
+        reset_arena_s(&block_arena);
+        add_stats(gp->stats, "state.read", &start, n_cells, 0);
+
+        /* one slab of the rows per variable */
+        start_stats_timer(gp->stats, &start);
+        start_idx[1] = row;
+        count[0] = s.nnode;
+        count[1] = rows;
+        count[2] = nlon;
+        nc_check(nc_put_vara_double(ncid, dz_node_varid, start_idx, count,
+                                    nodes),
+                 "Cannot put variable: dz_node\n");
+        nc_check(nc_put_vara_double(ncid, node_depth_varid, start_idx,
+                                    count, nodes + s.nnode * ngrid),
+                 "Cannot put variable: node_depth\n");
+
+        for (v = 0; v < N_STATE_VARS; v++) {
+            size_t var_start[6] = { 0 }, var_count[6] = { s.nclasses,
+                s.nbands
+            };
+            int d = 2;
+
+            if (!s.counts[v])
+                continue;
+            if (state_vars[v].count == LAYERS ||
+                state_vars[v].count == LAYERS_FROST)
+                var_count[d++] = gp->nlayer;
+            if (state_vars[v].count == LAYERS_FROST)
+                var_count[d++] = s.nfrost;
+            if (state_vars[v].count == NODES)
+                var_count[d++] = s.nnode;
+            var_start[d] = row;
+            var_count[d++] = rows;
+            var_count[d++] = nlon;
+
+            nc_check(nc_put_vara_double(ncid, varids[v], var_start,
+                                        var_count, values[v]),
+                     "Cannot put variable: %s\n", state_vars[v].name);
+        }
+        add_stats(gp->stats, "state.write", &start, n_cells,
+                  sizeof(double) * cell_values * ngrid);
+    }
+
+    start_stats_timer(gp->stats, &start);
+    nc_check(nc_close(ncid), "Cannot close file: %s\n", path);
+    add_stats(gp->stats, "state.close", &start, 0, 0);
+
+    for (v = 0; v < N_STATE_VARS; v++)
+        free(values[v]);
+    free(nodes);
+    free_arena_s(&block_arena);
+    if (veg_reader) {
+        close_line_reader(veg_reader);
+        free(veg_reader);
+    }
+    free(s.offsets);
+    if (s.binary) {
+        close(s.fd);
+        free(s.record);
+    }
+    else
+        close_line_reader(&s.reader);
+}
+
+/* the state date, and nlayer and nnode, which must be those of the global
+ * parameters; binary files before VIC 5 have no sec, which is told by the
+ * counts that follow */
+static void read_state_header(struct state_s *s)
+{
+    struct global_params_s *gp = s->gp;
+    size_t counts[2];
+    char *line;
+    int i;
+
+    if (s->binary) {
+        int date[4];
+
+        if (pread(s->fd, date, sizeof date, 0) != sizeof date ||
+            pread(s->fd, counts, sizeof counts, sizeof date) !=
+            sizeof counts)
+            error("Cannot read the header: %s\n", s->path);
+        if (counts[0] != (size_t)gp->nlayer ||
+            counts[1] != (size_t)s->nnode) {
+            if (pread(s->fd, counts, sizeof counts, 3 * sizeof(int)) !=
+                sizeof counts)
+                error("Cannot read the header: %s\n", s->path);
+            date[3] = 0;
+            s->next = 3 * sizeof(int) + sizeof counts;
+        }
+        else
+            s->next = sizeof date + sizeof counts;
+        memcpy(s->date, date, sizeof date);
+    }
+    else {
+        if (!(line = read_line(&s->reader)))
+            error("Cannot read the header: %s\n", s->path);
+        parse_line(&s->parser, line);
+        for (i = 0; i < 3; i++)
+            s->date[i] = parse_int(&s->parser);
+        s->date[3] = is_blank_line(&s->parser) ? 0 : parse_int(&s->parser);
+
+        if (!(line = read_line(&s->reader)))
+            error("Cannot read the header: %s\n", s->path);
+        parse_line(&s->parser, line);
+        counts[0] = parse_int(&s->parser);
+        counts[1] = parse_int(&s->parser);
+    }
+
+    if (counts[0] != (size_t)gp->nlayer)
+        error("State file has %zu layers instead of NLAYER %d: %s\n",
+              counts[0], gp->nlayer, s->path);
+    if (counts[1] != (size_t)s->nnode)
+        error("State file has %zu nodes instead of NODES %d: %s\n",
+              counts[1], s->nnode, s->path);
+}
+
+/* find the record of each cell by its cellnum; every active cell needs
+ * one */
+static void scan_state(struct state_s *s)
+{
+    struct soil_s *soil = s->soil;
+    const int *gridcels = soil->cells ? soil->cells->gridcel :
+        soil->gridcels;
+    struct gridcel_index_s index;
+    struct state_cell_s cell;
+    long offset;
+    int i, j, n = 0;
+
+    init_gridcel_index_s(&index, gridcels, soil->n_cells);
+    s->offsets = malloc(sizeof *s->offsets * soil->n_cells);
+    for (i = 0; i < soil->n_cells; i++)
+        s->offsets[i] = -1;
+
+    while (offset = s->binary ? s->next : s->reader.next,
+           read_cell_header(s, &cell)) {
+        if ((i = find_gridcel(&index, cell.gridcel)) < 0)
+            error("Cannot find grid cell %d of the state file in the soil "
+                  "file: %s\n", cell.gridcel, s->path);
+        if (s->offsets[i] >= 0)
+            error("Grid cell %d has several states: %s\n", cell.gridcel,
+                  s->path);
+        s->offsets[i] = offset;
+        n++;
+
+        if (s->binary) {
+            s->next += sizeof(int) * 2 + sizeof(size_t) * 2 + cell.Nbytes;
+            continue;
+        }
+        for (j = 0; j < (cell.Nveg + 1) * s->nbands; j++)
+            if (!read_line(&s->reader))
+                error("Cannot read the state of grid cell %d: %s\n",
+                      cell.gridcel, s->path);
+    }
+
+    for (i = 0; i < soil->n_cells; i++)
+        if (s->offsets[i] < 0 && is_active_cell(soil, i))
+            error("Cannot find the state of grid cell %d: %s\n",
+                  gridcels[i], s->path);
+
+    fprintf(stderr, "Found the states of %d cells: %s\n", n, s->path);
+
+    free_gridcel_index_s(&index);
+}
+
+/* read cellnum, Nveg and Nbands of the next cell, and in binary files the
+ * size of the rest of the record, which must be that of the layout, or
+ * return 0 at the end of the file; ASCII files are left at the first value
+ * after Nbands */
+static int read_cell_header(struct state_s *s, struct state_cell_s *cell)
+{
+    if (s->binary) {
+        unsigned char buf[sizeof(int) * 2 + sizeof(size_t) * 2];
+        ssize_t count = pread(s->fd, buf, sizeof buf, s->next);
+
+        if (!count)
+            return 0;
+        if (count != sizeof buf)
+            error("Cannot read the state at byte %zu: %s\n", s->next,
+                  s->path);
+        memcpy(&cell->gridcel, buf, sizeof(int));
+        memcpy(&cell->Nveg, buf + sizeof(int), sizeof(int));
+        memcpy(&cell->Nbands, buf + sizeof(int) * 2, sizeof(size_t));
+        memcpy(&cell->Nbytes, buf + sizeof(int) * 2 + sizeof(size_t),
+               sizeof(size_t));
+    }
+    else {
+        char *line;
+
+        do
+            if (!(line = read_line(&s->reader)))
+                return 0;
+        while (parse_line(&s->parser, line), is_blank_line(&s->parser));
+
+        cell->gridcel = parse_int(&s->parser);
+        cell->Nveg = parse_int(&s->parser);
+        cell->Nbands = parse_int(&s->parser);
+    }
+
+    if (cell->Nveg < 0 || cell->Nbands != (size_t)s->nbands)
+        error("Grid cell %d has %d tiles and %zu snow bands instead of %d: "
+              "%s\n", cell->gridcel, cell->Nveg, cell->Nbands, s->nbands,
+              s->path);
+    if (s->binary && cell->Nbytes != cell_bytes(s, cell->Nveg))
+        error("Grid cell %d has %zu bytes of state instead of %zu: %s\n",
+              cell->gridcel, cell->Nbytes, cell_bytes(s, cell->Nveg),
+              s->path);
+
+    return 1;
+}
+
+/* binary bytes after Nbytes of a cell with Nveg vegetated tiles */
+static size_t cell_bytes(struct state_s *s, int Nveg)
+{
+    return sizeof(double) * 2 * s->nnode + (size_t)s->nbands *
+        (Nveg * tile_bytes(s, true) + tile_bytes(s, false));
+}
+
+static size_t tile_bytes(struct state_s *s, bool vegetated)
+{
+    size_t size = sizeof(int) * 2;
+    int v;
+
+    for (v = 0; v < N_STATE_VARS; v++)
+        if (vegetated || !state_vars[v].vegetated)
+            size += state_type_size(state_vars[v].type) * s->counts[v];
+
+    return size;
+}
+
+/* read the record of soil cell c into the values of grid cell g of a block
+ * of ngrid grid cells: [class][band][value][grid] for each variable and
+ * [node][grid] for dz_node then node_depth */
+static void read_cell(struct state_s *s, int c, int g, size_t ngrid,
+                      double **values, double *nodes, struct arena_s *arena,
+                      struct line_reader_s *veg_reader)
+{
+    struct state_cell_s cell;
+    int *classes;
+    int veg, band, v, k;
+
+    if (s->binary)
+        s->next = s->offsets[c];
+    else
+        seek_line(&s->reader, s->offsets[c]);
+    read_cell_header(s, &cell);
+    if (s->binary) {
+        if (cell.Nbytes > s->record_size)
+            s->record = realloc(s->record, s->record_size = cell.Nbytes);
+        if (pread(s->fd, s->record, cell.Nbytes, s->offsets[c] +
+                  sizeof(int) * 2 + sizeof(size_t) * 2) !=
+            (ssize_t)cell.Nbytes)
+            error("Cannot read the state of grid cell %d: %s\n",
+                  cell.gridcel, s->path);
+        cell.p = s->record;
+    }
+
+    classes = tile_classes(s, c, cell.Nveg, arena, veg_reader);
+
+    for (k = 0; k < 2 * s->nnode; k++)
+        nodes[k * ngrid + g] = read_value(s, &cell, STATE_DOUBLE);
+
+    for (veg = 0; veg <= cell.Nveg; veg++)
+        for (band = 0; band < s->nbands; band++) {
+            int tile_veg, tile_band;
+
+            if (!s->binary) {
+                char *line = read_line(&s->reader);
+
+                if (!line)
+                    error("Cannot read the state of grid cell %d: %s\n",
+                          cell.gridcel, s->path);
+                parse_line(&s->parser, line);
+                tile_veg = parse_int(&s->parser);
+                tile_band = parse_int(&s->parser);
+            }
+            else {
+                memcpy(&tile_veg, cell.p, sizeof(int));
+                memcpy(&tile_band, cell.p + sizeof(int), sizeof(int));
+                cell.p += sizeof(int) * 2;
+            }
+            if (tile_veg != veg || tile_band != band)
+                error("Expected tile %d band %d of grid cell %d instead of "
+                      "tile %d band %d: %s\n", veg, band, cell.gridcel,
+                      tile_veg, tile_band, s->path);
+
+            for (v = 0; v < N_STATE_VARS; v++) {
+                size_t base = ((size_t)classes[veg] * s->nbands + band) *
+                    s->counts[v];
+
+                if (veg == cell.Nveg && state_vars[v].vegetated)
+                    continue;
+                for (k = 0; k < s->counts[v]; k++) {
+                    double value = read_value(s, &cell, state_vars[v].type);
+
+                    if (classes[veg] >= 0)
+                        values[v][(base + k) * ngrid + g] = value;
+                }
+            }
+        }
+}
+
+static double read_value(struct state_s *s, struct state_cell_s *cell,
+                         enum state_type type)
+{
+    double value;
+
+    if (!s->binary)
+        return type == STATE_DOUBLE ? parse_double(&s->parser) :
+            parse_int(&s->parser);
+
+    switch (type) {
+    case STATE_UINT:
+        {
+            unsigned int u;
+
+            memcpy(&u, cell->p, sizeof u);
+            value = u;
+            break;
+        }
+    case STATE_CHAR:
+        value = *(const char *)cell->p;
+        break;
+    default:
+        memcpy(&value, cell->p, sizeof value);
+    }
+    cell->p += state_type_size(type);
+
+    return value;
+}
+
+/* veg_class index of each of the Nveg + 1 tiles of soil cell c; the bare
+ * soil tile goes to the last class of the library, which is bare soil in
+ * the standard ones, and is dropped if a vegetated tile already covers the
+ * whole cell with that class */
+static int *tile_classes(struct state_s *s, int c, int Nveg,
+                         struct arena_s *arena,
+                         struct line_reader_s *veg_reader)
+{
+    struct soil_s *soil = s->soil;
+    int gridcel = soil->cells ? soil->cells->gridcel[c] : soil->gridcels[c];
+    int *classes = arena_alloc(arena, sizeof *classes * (Nveg + 1));
+    int bare = s->nclasses - 1;
+    struct veg_cell_s *veg_cell, veg_cell_buf;
+    double Cv = 0;
+    int j;
+
+    if (veg_reader) {
+        long offset = find_veg_cell_offset(s->veg_params, gridcel);
+
+        if (offset < 0)
+            error("Cannot find vegetation parameters for grid cell %d\n",
+                  gridcel);
+        read_veg_cell_at(s->gp, veg_reader, offset, arena, &veg_cell_buf);
+        veg_cell = &veg_cell_buf;
+    }
+    else if (!(veg_cell = find_veg_cell(s->veg_params, gridcel)))
+        error("Cannot find vegetation parameters for grid cell %d\n",
+              gridcel);
+
+    if (veg_cell->Nveg != Nveg)
+        error("Grid cell %d has %d vegetation tiles in the state file "
+              "instead of %d: %s\n", gridcel, Nveg, veg_cell->Nveg,
+              s->path);
+
+    classes[Nveg] = bare;
+    for (j = 0; j < Nveg; j++) {
+        if ((classes[j] = find_veg_class(s->veg_lib,
+                                         veg_cell->veg_class[j])) < 0)
+            error("Cannot find vegetation library for grid cell %d "
+                  "vegetation class %d\n", gridcel, veg_cell->veg_class[j]);
+        if (classes[j] == bare)
+            classes[Nveg] = -1;
+        Cv += veg_cell->Cv[j];
+    }
+    if (classes[Nveg] < 0 && Cv < 1 - 1e-6)
+        error("Grid cell %d has bare soil and a tile of the last "
+              "vegetation class, where bare soil is stored: %s\n", gridcel,
+              s->path);
+
+    return classes;
+}
+
+static size_t state_type_size(enum state_type type)
+{
+    switch (type) {
+    case STATE_UINT:
+        return sizeof(unsigned int);
+    case STATE_CHAR:
+        return sizeof(char);
+    default:
+        return sizeof(double);
+    }
+}
+
+static void fill_doubles(double *values, size_t n, double value)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        values[i] = value;
+}
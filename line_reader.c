@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "global.h"
+#include "line_reader.h"
+
+#define READ_SIZE (1024 * 1024)
+
+static void read_all(struct line_reader_s *, int);
+
+void open_line_reader(struct line_reader_s *reader, const char *path)
+{
+    struct stat st;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        error("Cannot open file: %s\n", path);
+
+    reader->path = path;
+    reader->data = NULL;
+    reader->size = 0;
+    reader->mapped = 0;
+    reader->tail = NULL;
+    reader->next = 0;
+    reader->offset = 0;
+
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode) || !st.st_size ||
+        (reader->data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd,
+                             0)) == MAP_FAILED)
+        read_all(reader, fd);
+    else {
+        reader->size = st.st_size;
+        reader->mapped = 1;
+        madvise(reader->data, reader->size, MADV_SEQUENTIAL);
+
+        /* the byte after the mapping may not be readable, so terminate a
+         * last line without '\n' in a copy */
+        if (reader->data[reader->size - 1] != '\n') {
+            size_t start = reader->size;
+
+            while (start > 0 && reader->data[start - 1] != '\n')
+                start--;
+
+            reader->tail = malloc(reader->size - start + 1);
+            memcpy(reader->tail, reader->data + start, reader->size - start);
+            reader->tail[reader->size - start] = 0;
+        }
+    }
+
+    reader->end = reader->size;
+
+    close(fd);
+}
+
+void close_line_reader(struct line_reader_s *reader)
+{
+    if (reader->mapped)
+        munmap(reader->data, reader->size);
+    else
+        free(reader->data);
+    free(reader->tail);
+}
+
+/* return the next line or NULL at the end of the file */
+char *read_line(struct line_reader_s *reader)
+{
+    char *line, *end;
+
+    if (reader->next >= reader->end)
+        return NULL;
+
+    line = reader->data + reader->next;
+    reader->offset = reader->next;
+
+    if ((end = memchr(line, '\n', reader->end - reader->next))) {
+        reader->next = end - reader->data + 1;
+        return line;
+    }
+
+    reader->next = reader->end;
+
+    return reader->tail ? reader->tail : line;
+}
+
+/* continue reading at offset, the start of a line */
+void seek_line(struct line_reader_s *reader, long offset)
+{
+    if (offset < 0 || (size_t)offset > reader->size)
+        error("Cannot read file: %s\n", reader->path);
+
+    reader->next = offset;
+    reader->end = reader->size;
+}
+
+/* split the lines of reader into n views that start and end at line
+ * boundaries and share its data */
+void split_line_reader(struct line_reader_s *reader, int n,
+                       struct line_reader_s *views)
+{
+    size_t start = reader->next;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        size_t end = start + (reader->end - start) / (n - i);
+        char *p;
+
+        if (end < reader->end &&
+            (p = memchr(reader->data + end, '\n', reader->end - end)))
+            end = p - reader->data + 1;
+        else
+            end = reader->end;
+
+        views[i] = *reader;
+        views[i].next = start;
+        views[i].end = end;
+        start = end;
+    }
+}
+
+/* return the number of the current line, counting from 1 */
+long line_number(struct line_reader_s *reader)
+{
+    const char *p = reader->data, *end = reader->data + reader->offset;
+    long line = 1;
+
+    while ((p = memchr(p, '\n', end - p))) {
+        line++;
+        p++;
+    }
+
+    return line;
+}
+
+/* read the whole file into memory with a terminating '\0' */
+static void read_all(struct line_reader_s *reader, int fd)
+{
+    size_t nalloc = READ_SIZE;
+    ssize_t n;
+
+    reader->data = malloc(nalloc + 1);
+
+    while ((n = read(fd, reader->data + reader->size,
+                     nalloc - reader->size)) > 0)
+        if ((reader->size += n) == nalloc) {
+            nalloc *= 2;
+            reader->data = realloc(reader->data, nalloc + 1);
+        }
+
+    if (n < 0)
+        error("Cannot read file: %s\n", reader->path);
+
+    reader->data[reader->size] = 0;
+}
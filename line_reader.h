@@ -0,0 +1,22 @@
+/* zero-copy line reader over a memory-mapped file, or over its contents
+ * read into memory if it cannot be mapped, such as a pipe; lines end with
+ * '\n' or '\0' and are not copied */
+struct line_reader_s
+{
+    const char *path;
+    char *data;
+    size_t size;
+    int mapped;
+    char *tail;                 /* copy of a last line without '\n' */
+    size_t next;                /* offset of the next line */
+    size_t end;                 /* offset where reading stops */
+    long offset;                /* offset of the current line */
+};
+
+/* line_reader.c */
+void open_line_reader(struct line_reader_s *, const char *);
+void close_line_reader(struct line_reader_s *);
+char *read_line(struct line_reader_s *);
+void seek_line(struct line_reader_s *, long);
+void split_line_reader(struct line_reader_s *, int, struct line_reader_s *);
+long line_number(struct line_reader_s *);
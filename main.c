@@ -1,45 +1,271 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
 #include "global.h"
 #include "vic.h"
+#include "stats.h"
+
+/* an input file read on its own thread */
+struct load_s
+{
+    struct global_params_s *gp;
+    const char *path;
+    void *(*read)(struct load_s *);
+    void *result;
+    double seconds;
+    long records;
+};
+
+static enum cell_area read_cell_area(const char *);
+static void *load(void *);
+static void *load_soil(struct load_s *);
+static void *load_veg_lib(struct load_s *);
+static void *load_veg_params(struct load_s *);
+static void *load_snow_bands(struct load_s *);
 
 int main(int argc, char **argv)
 {
     int i = 1;
     char *classic_gp_path, *image_prefix;
+    size_t max_memory = 0;
+    int threads = 1, io_threads = -1, compress_level = 0;
+    bool forcing = false, history = false, state = false;
+    enum cell_area cell_area = ROW_AREA;
     struct global_params_s *gp;
     struct soil_s *soil;
     struct veg_lib_s *veg_lib;
     struct veg_params_s *veg_params;
+    struct snow_band_params_s *snow_bands;
+    struct load_s loads[4];
+    pthread_t load_threads[4];
+    int n_loads = 3;
+    const char *load_names[4] = { "soil", "veg_lib", "veg_params",
+        "snow_bands"
+    };
+    const char *stats_path = NULL;
+    struct stats_s stats, *gp_stats = NULL;
+    struct timespec start;
+
+    while (i < argc && strncmp(argv[i], "--", 2) == 0) {
+        if (strcmp(argv[i], "--max-memory") == 0 && i + 1 < argc) {
+            max_memory = read_size(argv[i + 1]);
+            i += 2;
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = read_threads(argv[i + 1]);
+            i += 2;
+        }
+        else if (strcmp(argv[i], "--io-threads") == 0 && i + 1 < argc) {
+            io_threads = read_threads(argv[i + 1]);
+            i += 2;
+        }
+        else if (strcmp(argv[i], "--compress") == 0 && i + 1 < argc) {
+            compress_level = read_compress_level(argv[i + 1]);
+            i += 2;
+        }
+        else if (strcmp(argv[i], "--cell-area") == 0 && i + 1 < argc) {
+            cell_area = read_cell_area(argv[i + 1]);
+            i += 2;
+        }
+        else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+            stats_path = argv[i + 1];
+            i += 2;
+        }
+        else if (strcmp(argv[i], "--forcing") == 0) {
+            forcing = true;
+            i++;
+        }
+        else if (strcmp(argv[i], "--history") == 0) {
+            history = true;
+            i++;
+        }
+        else if (strcmp(argv[i], "--state") == 0) {
+            state = true;
+            i++;
+        }
+        else
+            error("Invalid option: %s\n", argv[i]);
+    }
 
-    if (argc < 3)
+    if (argc - i < 2)
         /*
            error
            ("Usage: vic_soil2nc classic_global.txt image_global.txt domain.nc domain_type:nc_name,... params.nc histfreq:count,...\n");
          */
         error
-            ("Usage: vic_classic_to_image classic_global.txt image_prefix\n");
+            ("Usage: vic_classic_to_image [--max-memory size[K|M|G]] [--threads n] [--io-threads n] [--compress level] [--cell-area rows|cells|exact] [--stats file] [--forcing] [--history] [--state] classic_global.txt image_prefix\n");
 
     classic_gp_path = argv[i++];
     image_prefix = argv[i++];
 
+    if (stats_path) {
+        init_stats_s(&stats);
+        gp_stats = &stats;
+    }
+
+    start_stats_timer(gp_stats, &start);
     gp = read_global_params(classic_gp_path);
     if (!is_classic(gp))
         error("Not a classic global parameters file: %s\n", classic_gp_path);
 
     populate_image_global_params(gp, image_prefix);
+    gp->max_memory = max_memory;
+    gp->threads = threads;
+    gp->forcing = forcing;
+    gp->history = history;
+    gp->state = state;
+    gp->io_threads = io_threads < 0 ? threads : io_threads;
+    gp->compress_level = compress_level;
+    gp->cell_area = cell_area;
+    gp->stats = gp_stats;
+    add_stats(gp->stats, "global_params", &start, 0,
+              stats_file_size(gp->stats, classic_gp_path));
 
-    soil = read_classic_soil(gp);
-    veg_lib = read_classic_veg_lib(gp);
-    veg_params = read_classic_veg_params(gp);
+    /* the files are independent, so read them concurrently */
+    loads[0].path = gp->soil;
+    loads[0].read = load_soil;
+    loads[1].path = gp->veglib;
+    loads[1].read = load_veg_lib;
+    loads[2].path = gp->vegparam;
+    loads[2].read = load_veg_params;
+    if (gp->snow_band && gp->snow_band->file) {
+        loads[3].path = gp->snow_band->file;
+        loads[3].read = load_snow_bands;
+        n_loads = 4;
+    }
+    start_stats_timer(gp->stats, &start);
+    for (i = 0; i < n_loads; i++) {
+        loads[i].gp = gp;
+        if (pthread_create(&load_threads[i], NULL, load, &loads[i]))
+            error("Cannot create thread\n");
+    }
+    for (i = 0; i < n_loads; i++) {
+        pthread_join(load_threads[i], NULL);
+        fprintf(stderr, "Read %s in %.3f s\n", loads[i].path,
+                loads[i].seconds);
+        add_stats_seconds(gp->stats, load_names[i], loads[i].seconds,
+                          loads[i].records,
+                          stats_file_size(gp->stats, loads[i].path));
+    }
+    add_stats(gp->stats, "load", &start, 0, 0);
+    soil = loads[0].result;
+    veg_lib = loads[1].result;
+    veg_params = loads[2].result;
+    snow_bands = n_loads > 3 ? loads[3].result : NULL;
 
+    start_stats_timer(gp->stats, &start);
     create_image_domain(gp, soil->domain);
-    create_image_params(gp, soil, veg_lib, veg_params);
+    add_stats(gp->stats, "domain", &start, soil->n_cells,
+              stats_file_size(gp->stats, gp->domain));
+
+    start_stats_timer(gp->stats, &start);
+    create_image_params(gp, soil, veg_lib, veg_params, snow_bands);
+    add_stats(gp->stats, "params", &start, soil->n_cells,
+              stats_file_size(gp->stats, gp->parameters));
+
+    if (gp->forcing) {
+        start_stats_timer(gp->stats, &start);
+        create_image_forcing(gp, soil);
+        add_stats(gp->stats, "forcing", &start, 0, 0);
+    }
+
+    if (gp->history) {
+        start_stats_timer(gp->stats, &start);
+        create_image_history(gp, soil);
+        add_stats(gp->stats, "history", &start, 0, 0);
+    }
+
+    if (gp->state) {
+        start_stats_timer(gp->stats, &start);
+        create_image_state(gp, soil, veg_lib, veg_params);
+        add_stats(gp->stats, "state", &start, 0, 0);
+    }
 
     free_global_params(gp);
     free_soil(soil);
     free_veg_lib(veg_lib);
     free_veg_params(veg_params);
+    if (snow_bands)
+        free_snow_band_params(snow_bands);
+
+    if (stats_path)
+        write_stats(&stats, stats_path);
 
     exit(EXIT_SUCCESS);
 }
+
+/* read a cell area method: rows, cells or exact */
+static enum cell_area read_cell_area(const char *buf)
+{
+    if (strcmp(buf, "rows") == 0)
+        return ROW_AREA;
+    if (strcmp(buf, "cells") == 0)
+        return CELL_AREA;
+    if (strcmp(buf, "exact") == 0)
+        return EXACT_AREA;
+
+    error("Invalid cell area: %s\n", buf);
+
+    return ROW_AREA;
+}
+
+/* run load->read and time it */
+static void *load(void *arg)
+{
+    struct load_s *load = arg;
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    load->result = load->read(load);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    load->seconds = end.tv_sec - start.tv_sec +
+        (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    return NULL;
+}
+
+/* in streaming mode, only the coordinates and file offsets of the cells are
+ * read here and create_image_params() reads the cells block by block; the
+ * records are counted for --stats */
+static void *load_soil(struct load_s *load)
+{
+    struct soil_s *soil = load->gp->max_memory ?
+        scan_classic_soil(load->gp) : read_classic_soil(load->gp);
+
+    load->records = soil->n_cells;
+
+    return soil;
+}
+
+static void *load_veg_lib(struct load_s *load)
+{
+    struct veg_lib_s *veg_lib = read_classic_veg_lib(load->gp);
+
+    load->records = veg_lib->n_classes;
+
+    return veg_lib;
+}
+
+static void *load_veg_params(struct load_s *load)
+{
+    struct veg_params_s *veg_params = load->gp->max_memory ?
+        scan_classic_veg_params(load->gp) :
+        read_classic_veg_params(load->gp);
+
+    load->records = veg_params->n_cells;
+
+    return veg_params;
+}
+
+static void *load_snow_bands(struct load_s *load)
+{
+    struct snow_band_params_s *snow_bands = load->gp->max_memory ?
+        scan_classic_snow_bands(load->gp) :
+        read_classic_snow_bands(load->gp);
+
+    load->records = snow_bands->n_cells;
+
+    return snow_bands;
+}
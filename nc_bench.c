@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <netcdf.h>
+#include "global.h"
+#include "vic.h"
+
+/* write time, read time and size of a [veg_class][month][lat][lon]
+ * parameter in classic format and in NetCDF-4 at several deflate levels,
+ * chunked as the converter chunks it and, at level 1, by other bands of lat
+ * rows; like LAI, each cell has a few of the classes and the others are
+ * zero, and it is read one lat x lon slab at a time as the image driver
+ * reads it */
+
+#define N_CLASSES 11
+#define N_MONTHS 12
+#define TILES 3
+#define PATH "nc_bench.nc"
+
+/* a deflate level and the largest chunk in bytes, or 0 to chunk as the
+ * converter does */
+struct variant_s
+{
+    int level;
+    size_t chunk_bytes;
+};
+
+static void bench(struct variant_s *, size_t, size_t, const double *);
+static double elapsed(struct timespec *);
+
+int main(int argc, char **argv)
+{
+    struct variant_s variants[] = {
+        {0, 0}, {1, 0}, {5, 0}, {9, 0},
+        {1, 1024 * 1024}, {1, 16 * 1024 * 1024}, {1, 64 * 1024 * 1024}
+    };
+    size_t nlat = 360, nlon = 720, ngrid, i;
+    double *values;
+    int j, k;
+
+    if (argc == 3) {
+        nlat = atoi(argv[1]);
+        nlon = atoi(argv[2]);
+    }
+    else if (argc != 1)
+        error("Usage: nc_bench [nlat nlon]\n");
+    ngrid = nlat * nlon;
+
+    values = calloc((size_t)N_CLASSES * N_MONTHS * ngrid, sizeof *values);
+    srand(1);
+    for (i = 0; i < ngrid; i++)
+        for (j = 0; j < TILES; j++) {
+            int class = rand() % N_CLASSES;
+
+            for (k = 0; k < N_MONTHS; k++)
+                values[((size_t)class * N_MONTHS + k) * ngrid + i] =
+                    (rand() % 1000) / 100.0;
+        }
+
+    printf("%d classes x %d months x %zu x %zu doubles (%.1f MB)\n",
+           N_CLASSES, N_MONTHS, nlat, nlon,
+           sizeof *values * N_CLASSES * N_MONTHS * ngrid / 1e6);
+    printf("%-9s %10s %10s %10s %10s\n", "format", "chunk MB", "write s",
+           "read s", "MB");
+    for (j = 0; j < sizeof variants / sizeof *variants; j++)
+        bench(&variants[j], nlat, nlon, values);
+
+    free(values);
+
+    return 0;
+}
+
+static void bench(struct variant_s *variant, size_t nlat, size_t nlon,
+                  const double *values)
+{
+    struct global_params_s gp;
+    struct timespec start;
+    struct stat st;
+    size_t ngrid = nlat * nlon;
+    size_t starts[4] = { 0, 0, 0, 0 };
+    size_t count[4] = { N_CLASSES, N_MONTHS, nlat, nlon };
+    size_t chunks[4] = { 1, 1, 0, nlon };
+    double write_time, read_time, *slab;
+    int ncid, dimids[4], varid, i, j;
+    char name[BUF_SIZE], chunk[BUF_SIZE];
+
+    memset(&gp, 0, sizeof gp);
+    gp.compress_level = variant->level;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    nc_check(nc_create(PATH, image_create_mode(&gp, sizeof *values *
+                                               N_CLASSES * N_MONTHS * ngrid),
+                       &ncid),
+             "Cannot create file: %s\n", PATH);
+    nc_check(nc_def_dim(ncid, "veg_class", N_CLASSES, &dimids[0]),
+             "Cannot define dimension: veg_class\n");
+    nc_check(nc_def_dim(ncid, "month", N_MONTHS, &dimids[1]),
+             "Cannot define dimension: month\n");
+    nc_check(nc_def_dim(ncid, "lat", nlat, &dimids[2]),
+             "Cannot define dimension: lat\n");
+    nc_check(nc_def_dim(ncid, "lon", nlon, &dimids[3]),
+             "Cannot define dimension: lon\n");
+    nc_check(nc_def_var(ncid, "LAI", NC_DOUBLE, 4, dimids, &varid),
+             "Cannot define variable: LAI\n");
+    chunk_image_vars(&gp, ncid, dimids[2], dimids[3]);
+    if (variant->chunk_bytes) {
+        chunks[2] = variant->chunk_bytes / (nlon * sizeof *values);
+        if (chunks[2] < 1)
+            chunks[2] = 1;
+        if (chunks[2] > nlat)
+            chunks[2] = nlat;
+        nc_check(nc_def_var_chunking(ncid, varid, NC_CHUNKED, chunks),
+                 "Cannot chunk variable: LAI\n");
+    }
+    if (variant->level)
+        nc_check(nc_inq_var_chunking(ncid, varid, NULL, chunks),
+                 "Cannot inquire variable: LAI\n");
+    nc_check(nc_enddef(ncid), "Cannot end definition\n");
+    nc_check(nc_put_vara_double(ncid, varid, starts, count, values),
+             "Cannot put variable: LAI\n");
+    nc_check(nc_close(ncid), "Cannot close file: %s\n", PATH);
+    write_time = elapsed(&start);
+
+    slab = malloc(sizeof *slab * ngrid);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    nc_check(nc_open(PATH, NC_NOWRITE, &ncid), "Cannot open file: %s\n",
+             PATH);
+    nc_check(nc_inq_varid(ncid, "LAI", &varid),
+             "Cannot inquire variable: LAI\n");
+    count[0] = count[1] = 1;
+    for (i = 0; i < N_CLASSES; i++)
+        for (j = 0; j < N_MONTHS; j++) {
+            starts[0] = i;
+            starts[1] = j;
+            nc_check(nc_get_vara_double(ncid, varid, starts, count, slab),
+                     "Cannot get variable: LAI\n");
+            if (memcmp(slab, values + ((size_t)i * N_MONTHS + j) * ngrid,
+                       sizeof *slab * ngrid))
+                error("Values read differ from written\n");
+        }
+    nc_check(nc_close(ncid), "Cannot close file: %s\n", PATH);
+    read_time = elapsed(&start);
+    free(slab);
+
+    if (stat(PATH, &st))
+        error("Cannot stat file: %s\n", PATH);
+    unlink(PATH);
+
+    if (variant->level) {
+        sprintf(name, "deflate %d", variant->level);
+        sprintf(chunk, "%.1f", chunks[2] * nlon * sizeof *values / 1e6);
+    }
+    else {
+        strcpy(name, "classic");
+        strcpy(chunk, "-");
+    }
+    printf("%-9s %10s %10.3f %10.3f %10.1f\n", name, chunk, write_time,
+           read_time, st.st_size / 1e6);
+}
+
+static double elapsed(struct timespec *start)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return end.tv_sec - start->tv_sec + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <netcdf.h>
+#include "global.h"
+#include "nc_writer.h"
+
+static void *run_nc_writer(void *);
+static int put_rows(int, int, size_t, size_t, const void *, size_t *);
+
+/* start writing to ncid from n_buffers buffers of size bytes; if timed,
+ * the time and bytes of the writes are added up */
+void init_nc_writer_s(struct nc_writer_s *writer, int ncid, int n_buffers,
+                      size_t size, int timed)
+{
+    int i;
+
+    writer->ncid = ncid;
+    writer->n_buffers = n_buffers;
+    writer->buffers = malloc(size * n_buffers);
+    writer->free_buffers = malloc(sizeof *writer->free_buffers * n_buffers);
+    for (i = 0; i < n_buffers; i++)
+        writer->free_buffers[i] = (char *)writer->buffers + size * i;
+    writer->n_free = n_buffers;
+    writer->writes = malloc(sizeof *writer->writes * n_buffers);
+    writer->first_write = writer->n_writes = 0;
+    writer->done = 0;
+    writer->timed = timed;
+    writer->put_seconds = 0;
+    writer->put_bytes = 0;
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->cond, NULL);
+
+    if (pthread_create(&writer->thread, NULL, run_nc_writer, writer))
+        error("Cannot create thread\n");
+}
+
+/* wait for the queued writes and stop the thread */
+void free_nc_writer_s(struct nc_writer_s *writer)
+{
+    pthread_mutex_lock(&writer->lock);
+    writer->done = 1;
+    pthread_cond_broadcast(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, NULL);
+
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->cond);
+    free(writer->buffers);
+    free(writer->free_buffers);
+    free(writer->writes);
+}
+
+/* a free staging buffer; waits for a write to finish if there is none */
+void *take_nc_buffer(struct nc_writer_s *writer)
+{
+    void *buffer;
+
+    pthread_mutex_lock(&writer->lock);
+    while (!writer->n_free)
+        pthread_cond_wait(&writer->cond, &writer->lock);
+    buffer = writer->free_buffers[--writer->n_free];
+    pthread_mutex_unlock(&writer->lock);
+
+    return buffer;
+}
+
+/* queue the lat rows [row, row + rows) of a [...][lat][lon] variable staged
+ * in buffer, which is free again once they are written */
+void write_nc_rows(struct nc_writer_s *writer, int varid, size_t row,
+                   size_t rows, void *buffer, const char *name)
+{
+    struct nc_write_s *write;
+
+    /* each queued write holds a buffer, so there is always room */
+    pthread_mutex_lock(&writer->lock);
+    write = &writer->writes[(writer->first_write + writer->n_writes++) %
+                            writer->n_buffers];
+    write->varid = varid;
+    write->row = row;
+    write->rows = rows;
+    write->buffer = buffer;
+    write->name = name;
+    pthread_cond_broadcast(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+}
+
+static void *run_nc_writer(void *arg)
+{
+    struct nc_writer_s *writer = arg;
+    struct nc_write_s write;
+    struct timespec start, end;
+    size_t bytes;
+
+    for (;;) {
+        pthread_mutex_lock(&writer->lock);
+        while (!writer->n_writes && !writer->done)
+            pthread_cond_wait(&writer->cond, &writer->lock);
+        if (!writer->n_writes) {
+            pthread_mutex_unlock(&writer->lock);
+            break;
+        }
+        write = writer->writes[writer->first_write];
+        writer->first_write = (writer->first_write + 1) % writer->n_buffers;
+        writer->n_writes--;
+        pthread_mutex_unlock(&writer->lock);
+
+        if (writer->timed)
+            clock_gettime(CLOCK_MONOTONIC, &start);
+        nc_check(put_rows(writer->ncid, write.varid, write.row, write.rows,
+                          write.buffer, writer->timed ? &bytes : NULL),
+                 "Cannot put variable: %s\n", write.name);
+        if (writer->timed) {
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            writer->put_seconds += end.tv_sec - start.tv_sec +
+                (end.tv_nsec - start.tv_nsec) / 1e9;
+            writer->put_bytes += bytes;
+        }
+
+        pthread_mutex_lock(&writer->lock);
+        writer->free_buffers[writer->n_free++] = write.buffer;
+        pthread_cond_broadcast(&writer->cond);
+        pthread_mutex_unlock(&writer->lock);
+    }
+
+    return NULL;
+}
+
+/* write the lat rows [row, row + rows) of a [...][lat][lon] variable and
+ * return their size in bytes if asked */
+static int put_rows(int ncid, int varid, size_t row, size_t rows,
+                    const void *values, size_t *bytes)
+{
+    int ndims, dimids[4];
+    size_t start[4], count[4];
+    nc_type type;
+    int status;
+    int i;
+
+    if ((status = nc_inq_varndims(ncid, varid, &ndims)) != NC_NOERR ||
+        (status = nc_inq_vardimid(ncid, varid, dimids)) != NC_NOERR)
+        return status;
+
+    for (i = 0; i < ndims; i++) {
+        if ((status = nc_inq_dimlen(ncid, dimids[i], &count[i])) != NC_NOERR)
+            return status;
+        start[i] = 0;
+    }
+    start[ndims - 2] = row;
+    count[ndims - 2] = rows;
+
+    if (bytes) {
+        if ((status = nc_inq_vartype(ncid, varid, &type)) != NC_NOERR ||
+            (status = nc_inq_type(ncid, type, NULL, bytes)) != NC_NOERR)
+            return status;
+        for (i = 0; i < ndims; i++)
+            *bytes *= count[i];
+    }
+
+    return nc_put_vara(ncid, varid, start, count, values);
+}
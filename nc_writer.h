@@ -0,0 +1,36 @@
+/* one block of lat rows of a variable waiting to be written */
+struct nc_write_s
+{
+    int varid;
+    size_t row, rows;
+    void *buffer;
+    const char *name;
+};
+
+/* a thread that makes all the netCDF writes of a file, which netCDF
+ * requires, from a pool of staging buffers; the next variables are gathered
+ * into the free buffers while it writes */
+struct nc_writer_s
+{
+    int ncid;
+    int n_buffers;
+    void *buffers;
+    void **free_buffers;
+    int n_free;
+    struct nc_write_s *writes;  /* ring of n_buffers */
+    int first_write, n_writes;
+    int done;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    int timed;                  /* time the writes for --stats */
+    double put_seconds;
+    size_t put_bytes;
+};
+
+/* nc_writer.c */
+void init_nc_writer_s(struct nc_writer_s *, int, int, size_t, int);
+void free_nc_writer_s(struct nc_writer_s *);
+void *take_nc_buffer(struct nc_writer_s *);
+void write_nc_rows(struct nc_writer_s *, int, size_t, size_t, void *,
+                   const char *);
@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "global.h"
+#include "line_reader.h"
+#include "parser.h"
+
+#define is_space(c) ((c) == ' ' || (c) == '\t')
+#define is_end(c) (!(c) || (c) == '\r' || (c) == '\n')
+#define is_digit(c) ((c) >= '0' && (c) <= '9')
+
+/* mantissas up to 2^53 and powers of ten up to 1e22 are exact doubles, so
+ * one multiplication or division rounds correctly */
+#define MAX_EXACT_MANTISSA (1ULL << 53)
+#define MAX_EXACT_POW10 22
+
+static const double pow10s[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static void skip_spaces(struct parser_s *);
+static void parse_error(struct parser_s *, const char *);
+
+void init_parser_s(struct parser_s *parser, struct line_reader_s *reader)
+{
+    parser->reader = reader;
+    parser->start = parser->p = NULL;
+}
+
+/* start parsing line, which ends with '\n' or '\0' */
+void parse_line(struct parser_s *parser, char *line)
+{
+    parser->start = parser->p = line;
+}
+
+/* return 1 if the rest of the line is empty or a comment */
+int is_blank_line(struct parser_s *parser)
+{
+    skip_spaces(parser);
+
+    return is_end(*parser->p) || *parser->p == '#';
+}
+
+double parse_double(struct parser_s *parser)
+{
+    char *p, *end;
+    unsigned long long mantissa = 0;
+    int digits = 0, exp10 = 0, negative = 0, any = 0;
+    double value;
+
+    skip_spaces(parser);
+    p = parser->p;
+
+    if (*p == '-' || *p == '+')
+        negative = *p++ == '-';
+
+    /* decimal fast path; leading zeros do not count against the 19 digits
+     * that fit in the mantissa */
+    for (; is_digit(*p); p++, any = 1)
+        if (digits < 19) {
+            if ((mantissa = mantissa * 10 + (*p - '0')))
+                digits++;
+        }
+        else
+            exp10++;
+    if (*p == '.')
+        for (p++; is_digit(*p); p++, any = 1)
+            if (digits < 19) {
+                if ((mantissa = mantissa * 10 + (*p - '0')))
+                    digits++;
+                exp10--;
+            }
+    if ((*p == 'e' || *p == 'E') && any) {
+        int exp_negative = 0, exp = 0;
+
+        p++;
+        if (*p == '-' || *p == '+')
+            exp_negative = *p++ == '-';
+        if (!is_digit(*p))
+            parse_error(parser, "a number");
+        for (; is_digit(*p); p++)
+            if (exp < 10000)
+                exp = exp * 10 + (*p - '0');
+        exp10 += exp_negative ? -exp : exp;
+    }
+
+    if (any && (is_space(*p) || is_end(*p)) && digits < 19 &&
+        mantissa <= MAX_EXACT_MANTISSA && exp10 >= -MAX_EXACT_POW10 &&
+        exp10 <= MAX_EXACT_POW10) {
+        value = exp10 < 0 ? mantissa / pow10s[-exp10] :
+            mantissa * pow10s[exp10];
+        parser->p = p;
+
+        return negative ? -value : value;
+    }
+
+    /* anything else, including inf, nan and hexadecimal; strtod would skip
+     * the line break of a mapped line and read on into the next line */
+    if (is_end(*parser->p))
+        parse_error(parser, "a number");
+    value = strtod(parser->p, &end);
+    if (end == parser->p || !(is_space(*end) || is_end(*end)))
+        parse_error(parser, "a number");
+    parser->p = end;
+
+    return value;
+}
+
+int parse_int(struct parser_s *parser)
+{
+    char *p;
+    long value = 0;
+    int negative = 0;
+
+    skip_spaces(parser);
+    p = parser->p;
+
+    if (*p == '-' || *p == '+')
+        negative = *p++ == '-';
+    if (!is_digit(*p))
+        parse_error(parser, "an integer");
+    for (; is_digit(*p); p++)
+        if ((value = value * 10 + (*p - '0')) > 2147483648L)
+            parse_error(parser, "an integer");
+    if (!(is_space(*p) || is_end(*p)) || (!negative && value > 2147483647L))
+        parse_error(parser, "an integer");
+    parser->p = p;
+
+    return negative ? -value : value;
+}
+
+/* return the rest of the line without leading spaces and its length
+ * without the line break */
+char *parse_rest(struct parser_s *parser, size_t *length)
+{
+    char *p;
+
+    skip_spaces(parser);
+    for (p = parser->p; !is_end(*p); p++) ;
+    *length = p - parser->p;
+
+    return parser->p;
+}
+
+static void skip_spaces(struct parser_s *parser)
+{
+    while (is_space(*parser->p))
+        parser->p++;
+}
+
+static void parse_error(struct parser_s *parser, const char *expected)
+{
+    struct line_reader_s *reader = parser->reader;
+    const char *found = is_end(*parser->p) ? " before end of line" : "";
+    int column = parser->p - parser->start + 1;
+
+    if (!reader)
+        error("Expected %s%s at column %d\n", expected, found, column);
+
+    error("Expected %s%s at line %ld, column %d: %s\n", expected, found,
+          line_number(reader), column, reader->path);
+}
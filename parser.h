@@ -0,0 +1,17 @@
+/* cursor over one line of a classic input file; numbers are parsed in
+ * place and malformed fields are reported with their line in reader and
+ * column */
+struct parser_s
+{
+    struct line_reader_s *reader;       /* NULL if not from a file */
+    char *start;                /* start of the line */
+    char *p;                    /* cursor */
+};
+
+/* parser.c */
+void init_parser_s(struct parser_s *, struct line_reader_s *);
+void parse_line(struct parser_s *, char *);
+int is_blank_line(struct parser_s *);
+double parse_double(struct parser_s *);
+int parse_int(struct parser_s *);
+char *parse_rest(struct parser_s *, size_t *);
@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "global.h"
+#include "parser.h"
+
+/* micro-benchmark of the line parser against the sscanf chain it replaced,
+ * on one soil line of 200 columns */
+
+#define N_COLUMNS 200
+#define N_ITERATIONS 20000
+
+#define swapbuf() do { char *p = p1; p1 = p2; p2 = p; } while(0)
+static char buf1[BUF_SIZE], buf2[BUF_SIZE], *p1 = buf1, *p2 = buf2;
+
+static double elapsed(struct timespec *);
+
+int main(void)
+{
+    char line[BUF_SIZE], *p = line;
+    double values[N_COLUMNS], sum_sscanf = 0, sum_parser = 0;
+    double t_sscanf, t_parser;
+    struct parser_s parser;
+    struct timespec start;
+    int i, j;
+
+    srand(1);
+    for (i = 0; i < N_COLUMNS; i++)
+        p += sprintf(p, "%.4f ", rand() / (double)RAND_MAX * 1000);
+    strcpy(p - 1, "\n");
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < N_ITERATIONS; i++) {
+        strcpy(p1, line);
+        for (j = 0; j < N_COLUMNS; j++) {
+            sscanf(p1, "%lf %[^\r\n]", &values[j], p2);
+            swapbuf();
+        }
+        sum_sscanf += values[N_COLUMNS - 1];
+    }
+    t_sscanf = elapsed(&start);
+
+    init_parser_s(&parser, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < N_ITERATIONS; i++) {
+        parse_line(&parser, line);
+        for (j = 0; j < N_COLUMNS; j++)
+            values[j] = parse_double(&parser);
+        sum_parser += values[N_COLUMNS - 1];
+    }
+    t_parser = elapsed(&start);
+
+    if (sum_sscanf != sum_parser)
+        error("Results differ: %g != %g\n", sum_sscanf, sum_parser);
+
+    printf("%d lines of %d columns (%d bytes)\n", N_ITERATIONS, N_COLUMNS,
+           (int)strlen(line));
+    printf("sscanf: %8.3f s %8.1f MB/s\n", t_sscanf,
+           strlen(line) * N_ITERATIONS / t_sscanf / 1e6);
+    printf("parser: %8.3f s %8.1f MB/s\n", t_parser,
+           strlen(line) * N_ITERATIONS / t_parser / 1e6);
+    printf("speedup: %.1fx\n", t_sscanf / t_parser);
+
+    return 0;
+}
+
+static double elapsed(struct timespec *start)
+{
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return end.tv_sec - start->tv_sec + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
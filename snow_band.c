@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "global.h"
+#include "gridcel_index.h"
+#include "line_reader.h"
+#include "parser.h"
+#include "vic.h"
+
+static struct snow_band_params_s *scan_snow_bands(struct global_params_s *,
+                                                  struct line_reader_s *,
+                                                  int);
+static void read_snow_band_values(struct global_params_s *,
+                                  struct parser_s *, double *);
+
+/* each line of the snow band file is a gridcel followed by the AreaFract,
+ * elevation and Pfactor of each of the SNOW_BAND bands */
+struct snow_band_params_s *read_classic_snow_bands(struct global_params_s
+                                                   *gp)
+{
+    struct snow_band_params_s *snow_bands;
+    struct line_reader_s reader;
+
+    open_line_reader(&reader, gp->snow_band->file);
+
+    snow_bands = scan_snow_bands(gp, &reader, 1);
+
+    close_line_reader(&reader);
+
+    /* the offsets are only needed in streaming mode */
+    free(snow_bands->offsets);
+    snow_bands->offsets = NULL;
+
+    return snow_bands;
+}
+
+/* first pass of the streaming mode */
+struct snow_band_params_s *scan_classic_snow_bands(struct global_params_s
+                                                   *gp)
+{
+    struct snow_band_params_s *snow_bands;
+    struct line_reader_s reader;
+
+    open_line_reader(&reader, gp->snow_band->file);
+
+    snow_bands = scan_snow_bands(gp, &reader, 0);
+
+    close_line_reader(&reader);
+
+    return snow_bands;
+}
+
+/* record the gridcel and file offset of every cell, and its values unless
+ * in streaming mode */
+static struct snow_band_params_s *scan_snow_bands(struct global_params_s *gp,
+                                                  struct line_reader_s
+                                                  *reader, int read_values)
+{
+    struct snow_band_params_s *snow_bands;
+    struct parser_s parser;
+    char *line;
+    int n_values = 3 * gp->snow_band->bands;
+    int nalloc = 0;
+
+    if (gp->snow_band->bands < 1)
+        error("Invalid SNOW_BAND: %d\n", gp->snow_band->bands);
+
+    snow_bands = malloc(sizeof *snow_bands);
+    snow_bands->bands = gp->snow_band->bands;
+    snow_bands->n_cells = 0;
+    snow_bands->gridcels = NULL;
+    snow_bands->values = NULL;
+    snow_bands->offsets = NULL;
+
+    init_parser_s(&parser, reader);
+
+    while ((line = read_line(reader))) {
+        parse_line(&parser, line);
+        if (is_blank_line(&parser))
+            continue;
+
+        if (snow_bands->n_cells == nalloc) {
+            nalloc += REALLOC_INCREMENT;
+            snow_bands->gridcels =
+                realloc(snow_bands->gridcels,
+                        sizeof *snow_bands->gridcels * nalloc);
+            snow_bands->offsets =
+                realloc(snow_bands->offsets,
+                        sizeof *snow_bands->offsets * nalloc);
+            if (read_values)
+                snow_bands->values =
+                    realloc(snow_bands->values,
+                            sizeof *snow_bands->values * nalloc * n_values);
+        }
+
+        snow_bands->gridcels[snow_bands->n_cells] = parse_int(&parser);
+        snow_bands->offsets[snow_bands->n_cells] = reader->offset;
+        if (read_values)
+            read_snow_band_values(gp, &parser, snow_bands->values +
+                                  (size_t)snow_bands->n_cells * n_values);
+        snow_bands->n_cells++;
+    }
+
+    snow_bands->cell_idx = malloc(sizeof *snow_bands->cell_idx);
+    init_gridcel_index_s(snow_bands->cell_idx, snow_bands->gridcels,
+                         snow_bands->n_cells);
+
+    return snow_bands;
+}
+
+/* second pass of the streaming mode: read the 3 * bands values of the cell
+ * at offset */
+void read_snow_band_cell_at(struct global_params_s *gp,
+                            struct line_reader_s *reader, long offset,
+                            double *values)
+{
+    struct parser_s parser;
+    char *line;
+
+    seek_line(reader, offset);
+    if (!(line = read_line(reader)))
+        error("Cannot read file: %s\n", gp->snow_band->file);
+
+    init_parser_s(&parser, reader);
+    parse_line(&parser, line);
+    parse_int(&parser);
+    read_snow_band_values(gp, &parser, values);
+}
+
+/* the values are kept as they are in the file; the image driver checks and
+ * normalizes them as the classic one does */
+static void read_snow_band_values(struct global_params_s *gp,
+                                  struct parser_s *parser, double *values)
+{
+    int i;
+
+    for (i = 0; i < 3 * gp->snow_band->bands; i++)
+        values[i] = parse_double(parser);
+}
+
+/* return the values of the first cell with gridcel or NULL */
+const double *find_snow_band_cell(struct snow_band_params_s *snow_bands,
+                                  int gridcel)
+{
+    int i = find_gridcel(snow_bands->cell_idx, gridcel);
+
+    return i < 0 ? NULL : snow_bands->values +
+        (size_t)i * 3 * snow_bands->bands;
+}
+
+/* return the file offset of the first cell with gridcel or -1 in the
+ * streaming mode */
+long find_snow_band_offset(struct snow_band_params_s *snow_bands,
+                           int gridcel)
+{
+    int i = find_gridcel(snow_bands->cell_idx, gridcel);
+
+    return i < 0 ? -1 : snow_bands->offsets[i];
+}
+
+void free_snow_band_params(struct snow_band_params_s *snow_bands)
+{
+    free(snow_bands->gridcels);
+    free(snow_bands->values);
+    free(snow_bands->offsets);
+    free_gridcel_index_s(snow_bands->cell_idx);
+    free(snow_bands->cell_idx);
+    free(snow_bands);
+}
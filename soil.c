@@ -2,33 +2,199 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
 #include "global.h"
 #include "double_stack.h"
+#include "line_reader.h"
+#include "parser.h"
 #include "vic.h"
 
-struct latlon_s
+#define MAX_SOIL_COLUMNS 35
+
+/* a value of a coordinate axis and its position before sorting */
+struct axis_value_s
 {
-    double lat, lon;
-} *ll;
+    double value;
+    int pos;
+};
 
-static int compare_soil_cells(const void *, const void *);
+/* cells parsed by one thread from one chunk of the soil file */
+struct soil_chunk_s
+{
+    struct global_params_s *gp;
+    struct line_reader_s *reader;
+    struct soil_table_s *cells;
+    struct double_stack_s lat, lon;     /* unique coordinates in file order */
+};
+
+/* one array of a soil table with n values of size bytes per cell */
+struct soil_column_s
+{
+    void **values;
+    size_t size;
+    int n;
+};
+
+static int list_soil_columns(struct soil_table_s *, struct soil_column_s *);
+static void grow_soil_table(struct soil_table_s *, int);
+static void append_soil_table(struct soil_table_s *, struct soil_table_s *);
+static void *read_soil_chunk(void *);
+static void sort_soil_table(struct soil_table_s *, const int *);
+static void read_soil_cell(struct global_params_s *, struct parser_s *,
+                           struct soil_table_s *, int);
+static void read_soil_layers(struct parser_s *, double *, int, int, int);
+static int *build_domain(struct global_params_s *, struct soil_s *,
+                         const int *, const double *, const double *,
+                         struct double_hash_s *, struct double_hash_s *);
+static int *sort_axis(struct double_stack_s *);
+static int compare_axis_values(const void *, const void *);
+static double *calc_row_areas_m2(struct global_params_s *,
+                                 const struct double_stack_s *);
 static double calc_cell_area_m2(struct global_params_s *, double, double);
 static double calc_distance_m(double, double, double, double);
 
-#define swapbuf() do { char *p = p1; p1 = p2; p2 = p; } while(0)
-static char buf1[BUF_SIZE], buf2[BUF_SIZE], *p1 = buf1, *p2 = buf2;
-
 struct soil_s *read_classic_soil(struct global_params_s *gp)
 {
     struct soil_s *soil;
     struct domain_s *domain;
-    struct soil_cell_s **cells;
-    FILE *fp;
+    struct soil_table_s *cells;
+    struct double_hash_s lat_hash, lon_hash;
+    struct line_reader_s reader, *views;
+    struct soil_chunk_s *chunks;
+    pthread_t *threads;
+    int n_chunks = gp->threads > 1 ? gp->threads : 1;
+    int *order;
+    int i, j;
+
+    open_line_reader(&reader, gp->soil);
+
+    /* parse chunks of whole lines in parallel; merging them in file order
+     * makes the result independent of the number of chunks */
+    views = malloc(sizeof *views * n_chunks);
+    chunks = malloc(sizeof *chunks * n_chunks);
+    threads = malloc(sizeof *threads * n_chunks);
+
+    split_line_reader(&reader, n_chunks, views);
+    for (i = 0; i < n_chunks; i++) {
+        chunks[i].gp = gp;
+        chunks[i].reader = &views[i];
+    }
+
+    if (n_chunks == 1)
+        read_soil_chunk(&chunks[0]);
+    else {
+        for (i = 0; i < n_chunks; i++)
+            if (pthread_create(&threads[i], NULL, read_soil_chunk,
+                               &chunks[i]))
+                error("Cannot create thread\n");
+        for (i = 0; i < n_chunks; i++)
+            pthread_join(threads[i], NULL);
+    }
+
+    close_line_reader(&reader);
+
+    soil = malloc(sizeof *soil);
+    soil->domain = domain = malloc(sizeof *domain);
+    domain->lat = malloc(sizeof *domain->lat);
+    domain->lon = malloc(sizeof *domain->lon);
+
+    init_double_stack_s(domain->lat);
+    init_double_stack_s(domain->lon);
+    init_double_hash_s(&lat_hash);
+    init_double_hash_s(&lon_hash);
+
+    soil->cells = cells = chunks[0].cells;
+    soil->offsets = NULL;
+    soil->run_cell = NULL;
+    soil->gridcels = NULL;
+
+    for (i = 0; i < n_chunks; i++) {
+        if (i) {
+            append_soil_table(cells, chunks[i].cells);
+            free_soil_table(chunks[i].cells);
+        }
+
+        for (j = 0; j < chunks[i].lat.n; j++)
+            push_unique_double(domain->lat, &lat_hash,
+                               chunks[i].lat.values[j]);
+        for (j = 0; j < chunks[i].lon.n; j++)
+            push_unique_double(domain->lon, &lon_hash,
+                               chunks[i].lon.values[j]);
+        free_double_stack_s(&chunks[i].lat);
+        free_double_stack_s(&chunks[i].lon);
+    }
+
+    free(threads);
+    free(chunks);
+    free(views);
+
+    soil->n_cells = cells->n_cells;
+
+    order = build_domain(gp, soil, cells->gridcel, cells->lat, cells->lon,
+                         &lat_hash, &lon_hash);
+    sort_soil_table(cells, order);
+
+    free_double_hash_s(&lat_hash);
+    free_double_hash_s(&lon_hash);
+    free(order);
+
+    return soil;
+}
+
+/* parse the lines of a chunk into its own table and coordinate sets */
+static void *read_soil_chunk(void *arg)
+{
+    struct soil_chunk_s *chunk = arg;
+    struct soil_table_s *cells;
+    struct double_hash_s lat_hash, lon_hash;
+    struct parser_s parser;
+    char *line;
+
+    chunk->cells = cells = alloc_soil_table(chunk->gp, REALLOC_INCREMENT);
+
+    init_double_stack_s(&chunk->lat);
+    init_double_stack_s(&chunk->lon);
+    init_double_hash_s(&lat_hash);
+    init_double_hash_s(&lon_hash);
+
+    init_parser_s(&parser, chunk->reader);
+
+    while ((line = read_line(chunk->reader))) {
+        if (cells->n_cells == cells->nalloc)
+            grow_soil_table(cells, cells->nalloc * 2);
+
+        parse_line(&parser, line);
+        read_soil_cell(chunk->gp, &parser, cells, cells->n_cells);
+
+        push_unique_double(&chunk->lat, &lat_hash, cells->lat[cells->n_cells]);
+        push_unique_double(&chunk->lon, &lon_hash, cells->lon[cells->n_cells]);
+        cells->n_cells++;
+    }
+
+    free_double_hash_s(&lat_hash);
+    free_double_hash_s(&lon_hash);
+
+    return NULL;
+}
+
+/* first pass of the streaming mode: collect the coordinates and file offset
+ * of every cell and build the domain without keeping any cell in memory */
+struct soil_s *scan_classic_soil(struct global_params_s *gp)
+{
+    struct soil_s *soil;
+    struct domain_s *domain;
+    struct double_hash_s lat_hash, lon_hash;
+    struct line_reader_s reader;
+    struct parser_s parser;
+    double *lat, *lon;
+    long *offsets;
+    char *line;
+    int *run_cell, *gridcel;
     int nalloc;
-    int i, j, k;
+    int *order;
+    int i;
 
-    if (!(fp = fopen(gp->soil, "r")))
-        error("Cannot open file: %s\n", gp->soil);
+    open_line_reader(&reader, gp->soil);
 
     nalloc = 0;
 
@@ -39,218 +205,481 @@ struct soil_s *read_classic_soil(struct global_params_s *gp)
 
     init_double_stack_s(domain->lat);
     init_double_stack_s(domain->lon);
+    init_double_hash_s(&lat_hash);
+    init_double_hash_s(&lon_hash);
 
     soil->n_cells = 0;
-    soil->cells = cells = NULL;
+    soil->cells = NULL;
+    run_cell = gridcel = NULL;
+    lat = lon = NULL;
+    offsets = NULL;
 
-    while (fgets(p1, BUF_SIZE, fp)) {
-        int run_cell, fs_active;
-        struct soil_cell_s *cell;
+    init_parser_s(&parser, &reader);
 
+    while ((line = read_line(&reader))) {
         if (soil->n_cells == nalloc) {
             nalloc += REALLOC_INCREMENT;
-            soil->cells = cells = realloc(cells, sizeof *cells * nalloc);
+            run_cell = realloc(run_cell, sizeof *run_cell * nalloc);
+            gridcel = realloc(gridcel, sizeof *gridcel * nalloc);
+            lat = realloc(lat, sizeof *lat * nalloc);
+            lon = realloc(lon, sizeof *lon * nalloc);
+            offsets = realloc(offsets, sizeof *offsets * nalloc);
         }
-        cells[soil->n_cells++] = cell = malloc(sizeof *cell);
 
-        sscanf(p1, "%d %d %lf %lf %lf %lf %lf %lf %lf %[^\r\n]", &run_cell,
-               &cell->gridcel, &cell->lat, &cell->lon, &cell->infilt,
-               &cell->Ds, &cell->Dsmax, &cell->Ws, &cell->c, p2);
-        swapbuf();
+        parse_line(&parser, line);
+        run_cell[soil->n_cells] = parse_int(&parser);
+        gridcel[soil->n_cells] = parse_int(&parser);
+        lat[soil->n_cells] = parse_double(&parser);
+        lon[soil->n_cells] = parse_double(&parser);
+        offsets[soil->n_cells] = reader.offset;
 
-        cell->run_cell = run_cell;
+        push_unique_double(domain->lat, &lat_hash, lat[soil->n_cells]);
+        push_unique_double(domain->lon, &lon_hash, lon[soil->n_cells]);
+        soil->n_cells++;
+    }
 
-        if (find_double(domain->lat, cell->lat) < 0)
-            push_double(domain->lat, cell->lat);
+    close_line_reader(&reader);
 
-        if (find_double(domain->lon, cell->lon) < 0)
-            push_double(domain->lon, cell->lon);
+    order = build_domain(gp, soil, gridcel, lat, lon, &lat_hash, &lon_hash);
 
-        cell->expt = malloc(sizeof *cell->expt * gp->nlayer);
-        for (i = 0; i < gp->nlayer; i++) {
-            sscanf(p1, "%lf %[^\r\n]", &cell->expt[i], p2);
-            swapbuf();
-        }
+    soil->offsets = malloc(sizeof *soil->offsets * soil->n_cells);
+    soil->run_cell = malloc(sizeof *soil->run_cell * soil->n_cells);
+    soil->gridcels = malloc(sizeof *soil->gridcels * soil->n_cells);
+    for (i = 0; i < soil->n_cells; i++) {
+        soil->offsets[i] = offsets[order[i]];
+        soil->run_cell[i] = run_cell[order[i]];
+        soil->gridcels[i] = gridcel[order[i]];
+    }
 
-        cell->Ksat = malloc(sizeof *cell->Ksat * gp->nlayer);
-        for (i = 0; i < gp->nlayer; i++) {
-            sscanf(p1, "%lf %[^\r\n]", &cell->Ksat[i], p2);
-            swapbuf();
-        }
+    free_double_hash_s(&lat_hash);
+    free_double_hash_s(&lon_hash);
+    free(order);
+    free(run_cell);
+    free(gridcel);
+    free(lat);
+    free(lon);
+    free(offsets);
 
-        cell->phi_s = malloc(sizeof *cell->phi_s * gp->nlayer);
-        for (i = 0; i < gp->nlayer; i++) {
-            sscanf(p1, "%lf %[^\r\n]", &cell->phi_s[i], p2);
-            swapbuf();
-        }
+    return soil;
+}
 
-        cell->init_moist = malloc(sizeof *cell->init_moist * gp->nlayer);
-        for (i = 0; i < gp->nlayer; i++) {
-            sscanf(p1, "%lf %[^\r\n]", &cell->init_moist[i], p2);
-            swapbuf();
-        }
+/* second pass of the streaming mode: read the cell at offset into row i of
+ * cells */
+void read_soil_cell_at(struct global_params_s *gp,
+                       struct line_reader_s *reader, long offset,
+                       struct soil_table_s *cells, int i)
+{
+    struct parser_s parser;
+    char *line;
 
-        sscanf(p1, "%lf %[^\r\n]", &cell->elev, p2);
-        swapbuf();
+    seek_line(reader, offset);
+    if (!(line = read_line(reader)))
+        error("Cannot read file: %s\n", gp->soil);
 
-        cell->depth = malloc(sizeof *cell->depth * gp->nlayer);
-        for (i = 0; i < gp->nlayer; i++) {
-            sscanf(p1, "%lf %[^\r\n]", &cell->depth[i], p2);
-            swapbuf();
-        }
+    init_parser_s(&parser, reader);
+    parse_line(&parser, line);
+    read_soil_cell(gp, &parser, cells, i);
+}
 
-        sscanf(p1, "%lf %lf %[^\r\n]", &cell->avg_T, &cell->dp, p2);
-        swapbuf();
+struct soil_table_s *alloc_soil_table(struct global_params_s *gp, int nalloc)
+{
+    struct soil_table_s *cells = calloc(1, sizeof *cells);
+    struct soil_column_s columns[MAX_SOIL_COLUMNS];
+    int n_columns, i;
+
+    cells->nlayer = gp->nlayer;
+    cells->organic_fract = gp->organic_fract;
+    cells->spatial_frost = gp->spatial_frost;
+    cells->july_tavg_supplied = gp->july_tavg_supplied;
+    cells->nalloc = nalloc;
+
+    n_columns = list_soil_columns(cells, columns);
+    for (i = 0; i < n_columns; i++)
+        *columns[i].values =
+            malloc(columns[i].size * columns[i].n * cells->nalloc);
+
+    return cells;
+}
 
-        cell->bubble = malloc(sizeof *cell->bubble * gp->nlayer);
-        for (i = 0; i < gp->nlayer; i++) {
-            sscanf(p1, "%lf %[^\r\n]", &cell->bubble[i], p2);
-            swapbuf();
-        }
+void free_soil_table(struct soil_table_s *cells)
+{
+    struct soil_column_s columns[MAX_SOIL_COLUMNS];
+    int n_columns, i;
 
-        cell->quartz = malloc(sizeof *cell->quartz * gp->nlayer);
-        for (i = 0; i < gp->nlayer; i++) {
-            sscanf(p1, "%lf %[^\r\n]", &cell->quartz[i], p2);
-            swapbuf();
-        }
+    n_columns = list_soil_columns(cells, columns);
+    for (i = 0; i < n_columns; i++)
+        free(*columns[i].values);
 
-        cell->bulk_density = malloc(sizeof *cell->bulk_density * gp->nlayer);
-        for (i = 0; i < gp->nlayer; i++) {
-            sscanf(p1, "%lf %[^\r\n]", &cell->bulk_density[i], p2);
-            swapbuf();
-        }
+    free(cells);
+}
 
-        cell->soil_density = malloc(sizeof *cell->soil_density * gp->nlayer);
-        for (i = 0; i < gp->nlayer; i++) {
-            sscanf(p1, "%lf %[^\r\n]", &cell->soil_density[i], p2);
-            swapbuf();
-        }
+/* list the arrays of cells that its flags enable */
+static int list_soil_columns(struct soil_table_s *cells,
+                             struct soil_column_s *columns)
+{
+    int n = 0;
+
+#define add_column(field, per_cell) \
+    do { \
+        columns[n].values = (void **)&cells->field; \
+        columns[n].size = sizeof *cells->field; \
+        columns[n++].n = per_cell; \
+    } while(0)
+
+    add_column(run_cell, 1);
+    add_column(gridcel, 1);
+    add_column(lat, 1);
+    add_column(lon, 1);
+    add_column(infilt, 1);
+    add_column(Ds, 1);
+    add_column(Dsmax, 1);
+    add_column(Ws, 1);
+    add_column(c, 1);
+    add_column(expt, cells->nlayer);
+    add_column(Ksat, cells->nlayer);
+    add_column(phi_s, cells->nlayer);
+    add_column(init_moist, cells->nlayer);
+    add_column(elev, 1);
+    add_column(depth, cells->nlayer);
+    add_column(avg_T, 1);
+    add_column(dp, 1);
+    add_column(bubble, cells->nlayer);
+    add_column(quartz, cells->nlayer);
+    add_column(bulk_density, cells->nlayer);
+    add_column(soil_density, cells->nlayer);
+    if (cells->organic_fract) {
+        add_column(organic, cells->nlayer);
+        add_column(bulk_dens_org, cells->nlayer);
+        add_column(soil_dens_org, cells->nlayer);
+    }
+    add_column(off_gmt, 1);
+    add_column(Wcr_FRACT, cells->nlayer);
+    add_column(Wpwp_FRACT, cells->nlayer);
+    add_column(rough, 1);
+    add_column(snow_rough, 1);
+    add_column(annual_prec, 1);
+    add_column(resid_moist, cells->nlayer);
+    add_column(fs_active, 1);
+    if (cells->spatial_frost) {
+        add_column(frost_slope, 1);
+        add_column(max_snow_distrib_slope, 1);
+    }
+    if (cells->july_tavg_supplied)
+        add_column(July_Tavg, 1);
 
-        if (gp->organic_fract) {
-            cell->organic = malloc(sizeof *cell->organic * gp->nlayer);
-            for (i = 0; i < gp->nlayer; i++) {
-                sscanf(p1, "%lf %[^\r\n]", &cell->organic[i], p2);
-                swapbuf();
-            }
-
-            cell->bulk_dens_org =
-                malloc(sizeof *cell->bulk_dens_org * gp->nlayer);
-            for (i = 0; i < gp->nlayer; i++) {
-                sscanf(p1, "%lf %[^\r\n]", &cell->bulk_dens_org[i], p2);
-                swapbuf();
-            }
-
-            cell->soil_dens_org =
-                malloc(sizeof *cell->soil_dens_org * gp->nlayer);
-            for (i = 0; i < gp->nlayer; i++) {
-                sscanf(p1, "%lf %[^\r\n]", &cell->soil_dens_org[i], p2);
-                swapbuf();
-            }
-        }
-        else
-            cell->organic = cell->bulk_dens_org = cell->soil_dens_org = NULL;
+#undef add_column
 
-        sscanf(p1, "%lf %[^\r\n]", &cell->off_gmt, p2);
-        swapbuf();
+    return n;
+}
 
-        cell->Wcr_FRACT = malloc(sizeof *cell->Wcr_FRACT * gp->nlayer);
-        for (i = 0; i < gp->nlayer; i++) {
-            sscanf(p1, "%lf %[^\r\n]", &cell->Wcr_FRACT[i], p2);
-            swapbuf();
-        }
+/* grow every array to nalloc cells and move the layers of the per-layer
+ * arrays to their new stride */
+static void grow_soil_table(struct soil_table_s *cells, int nalloc)
+{
+    struct soil_column_s columns[MAX_SOIL_COLUMNS];
+    int n_columns, i, j;
+
+    n_columns = list_soil_columns(cells, columns);
+    for (i = 0; i < n_columns; i++) {
+        size_t size = columns[i].size;
+        char *values =
+            realloc(*columns[i].values, size * columns[i].n * nalloc);
+
+        for (j = columns[i].n - 1; j > 0; j--)
+            memmove(values + size * j * nalloc,
+                    values + size * j * cells->nalloc,
+                    size * cells->n_cells);
+        *columns[i].values = values;
+    }
 
-        cell->Wpwp_FRACT = malloc(sizeof *cell->Wpwp_FRACT * gp->nlayer);
-        for (i = 0; i < gp->nlayer; i++) {
-            sscanf(p1, "%lf %[^\r\n]", &cell->Wpwp_FRACT[i], p2);
-            swapbuf();
-        }
+    cells->nalloc = nalloc;
+}
 
-        sscanf(p1, "%lf %lf %lf %[^\r\n]", &cell->rough, &cell->snow_rough,
-               &cell->annual_prec, p2);
-        swapbuf();
+/* append the cells of src to cells */
+static void append_soil_table(struct soil_table_s *cells,
+                              struct soil_table_s *src)
+{
+    struct soil_column_s columns[MAX_SOIL_COLUMNS];
+    struct soil_column_s src_columns[MAX_SOIL_COLUMNS];
+    int n_columns, i, j;
+
+    if (cells->n_cells + src->n_cells > cells->nalloc)
+        grow_soil_table(cells, cells->n_cells + src->n_cells);
+
+    n_columns = list_soil_columns(cells, columns);
+    list_soil_columns(src, src_columns);
+    for (i = 0; i < n_columns; i++) {
+        size_t size = columns[i].size;
+
+        for (j = 0; j < columns[i].n; j++)
+            memcpy((char *)*columns[i].values +
+                   size * ((size_t)j * cells->nalloc + cells->n_cells),
+                   (char *)*src_columns[i].values +
+                   size * (size_t)j * src->nalloc, size * src->n_cells);
+    }
 
-        cell->resid_moist = malloc(sizeof *cell->resid_moist * gp->nlayer);
-        for (i = 0; i < gp->nlayer; i++) {
-            sscanf(p1, "%lf %[^\r\n]", &cell->resid_moist[i], p2);
-            swapbuf();
-        }
+    cells->n_cells += src->n_cells;
+}
 
-        sscanf(p1, "%d %[^\r\n]", &fs_active, p2);
-        swapbuf();
+/* reorder the cells so that row k is the old row order[k] and shrink the
+ * arrays to fit */
+static void sort_soil_table(struct soil_table_s *cells, const int *order)
+{
+    struct soil_column_s columns[MAX_SOIL_COLUMNS];
+    int n_columns, i, j, k;
+
+    n_columns = list_soil_columns(cells, columns);
+    for (i = 0; i < n_columns; i++) {
+        size_t size = columns[i].size;
+        char *values = *columns[i].values;
+        char *sorted = malloc(size * columns[i].n * cells->n_cells);
+
+        for (j = 0; j < columns[i].n; j++)
+            for (k = 0; k < cells->n_cells; k++)
+                memcpy(sorted + size * ((size_t)j * cells->n_cells + k),
+                       values + size * ((size_t)j * cells->nalloc +
+                                        order[k]), size);
+        free(values);
+        *columns[i].values = sorted;
+    }
 
-        cell->fs_active = fs_active;
+    cells->nalloc = cells->n_cells;
+}
 
-        if (gp->spatial_frost) {
-            sscanf(p1, "%lf %lf %[^\r\n]", &cell->frost_slope,
-                   &cell->max_snow_distrib_slope, p2);
-            swapbuf();
-        }
+/* parse the soil cell on the line of parser into row i of cells */
+static void read_soil_cell(struct global_params_s *gp,
+                           struct parser_s *parser,
+                           struct soil_table_s *cells, int i)
+{
+    int nalloc = cells->nalloc;
+
+    cells->run_cell[i] = parse_int(parser);
+    cells->gridcel[i] = parse_int(parser);
+    cells->lat[i] = parse_double(parser);
+    cells->lon[i] = parse_double(parser);
+    cells->infilt[i] = parse_double(parser);
+    cells->Ds[i] = parse_double(parser);
+    cells->Dsmax[i] = parse_double(parser);
+    cells->Ws[i] = parse_double(parser);
+    cells->c[i] = parse_double(parser);
+
+    read_soil_layers(parser, cells->expt, nalloc, i, gp->nlayer);
+    read_soil_layers(parser, cells->Ksat, nalloc, i, gp->nlayer);
+    read_soil_layers(parser, cells->phi_s, nalloc, i, gp->nlayer);
+    read_soil_layers(parser, cells->init_moist, nalloc, i, gp->nlayer);
+
+    cells->elev[i] = parse_double(parser);
+
+    read_soil_layers(parser, cells->depth, nalloc, i, gp->nlayer);
+
+    cells->avg_T[i] = parse_double(parser);
+    cells->dp[i] = parse_double(parser);
+
+    read_soil_layers(parser, cells->bubble, nalloc, i, gp->nlayer);
+    read_soil_layers(parser, cells->quartz, nalloc, i, gp->nlayer);
+    read_soil_layers(parser, cells->bulk_density, nalloc, i, gp->nlayer);
+    read_soil_layers(parser, cells->soil_density, nalloc, i, gp->nlayer);
+
+    if (gp->organic_fract) {
+        read_soil_layers(parser, cells->organic, nalloc, i, gp->nlayer);
+        read_soil_layers(parser, cells->bulk_dens_org, nalloc, i,
+                         gp->nlayer);
+        read_soil_layers(parser, cells->soil_dens_org, nalloc, i,
+                         gp->nlayer);
+    }
 
-        if (gp->july_tavg_supplied) {
-            sscanf(p1, "%lf %[^\r\n]", &cell->July_Tavg, p2);
-            swapbuf();
-        }
+    cells->off_gmt[i] = parse_double(parser);
+
+    read_soil_layers(parser, cells->Wcr_FRACT, nalloc, i, gp->nlayer);
+    read_soil_layers(parser, cells->Wpwp_FRACT, nalloc, i, gp->nlayer);
+
+    cells->rough[i] = parse_double(parser);
+    cells->snow_rough[i] = parse_double(parser);
+    cells->annual_prec[i] = parse_double(parser);
+
+    read_soil_layers(parser, cells->resid_moist, nalloc, i, gp->nlayer);
+
+    cells->fs_active[i] = parse_int(parser);
+
+    if (gp->spatial_frost) {
+        cells->frost_slope[i] = parse_double(parser);
+        cells->max_snow_distrib_slope[i] = parse_double(parser);
     }
 
-    if (ferror(fp))
-        error("Cannot read file: %s\n", gp->soil);
+    if (gp->july_tavg_supplied)
+        cells->July_Tavg[i] = parse_double(parser);
+}
+
+/* parse nlayer values into the [nlayer][nalloc] array field */
+static void read_soil_layers(struct parser_s *parser, double *field,
+                             int nalloc, int i, int nlayer)
+{
+    int j;
+
+    for (j = 0; j < nlayer; j++)
+        field[(size_t)j * nalloc + i] = parse_double(parser);
+}
 
-    fclose(fp);
+/* sort the axes and the cells by grid index, collect the index of the
+ * first cell in each lat row and the grid index of each cell, and fill the
+ * mask, area and frac of the domain; gridcel, lat and lon describe the
+ * cells in file order and the hashes index the values of lat and lon in
+ * the unsorted axes; return the file order of the sorted cells */
+static int *build_domain(struct global_params_s *gp, struct soil_s *soil,
+                         const int *gridcel, const double *lat,
+                         const double *lon,
+                         struct double_hash_s *lat_hash,
+                         struct double_hash_s *lon_hash)
+{
+    struct domain_s *domain = soil->domain;
+    int nlat = domain->lat->n, nlon = domain->lon->n;
+    int *lat_idx, *lon_idx, *lat_rank, *lon_rank, *count, *by_lon, *order;
+    double *row_areas = NULL;
+    int i, k;
+
+    /* the hashes hold every coordinate, so this only looks them up */
+    lat_idx = malloc(sizeof *lat_idx * soil->n_cells);
+    lon_idx = malloc(sizeof *lon_idx * soil->n_cells);
+    for (i = 0; i < soil->n_cells; i++) {
+        lat_idx[i] = push_unique_double(domain->lat, lat_hash, lat[i]);
+        lon_idx[i] = push_unique_double(domain->lon, lon_hash, lon[i]);
+    }
 
-    qsort(domain->lat->values, domain->lat->n, sizeof(double),
-          compare_doubles);
-    qsort(domain->lon->values, domain->lon->n, sizeof(double),
-          compare_doubles);
+    lat_rank = sort_axis(domain->lat);
+    lon_rank = sort_axis(domain->lon);
+    for (i = 0; i < soil->n_cells; i++) {
+        lat_idx[i] = lat_rank[lat_idx[i]];
+        lon_idx[i] = lon_rank[lon_idx[i]];
+    }
+    free(lat_rank);
+    free(lon_rank);
 
-    if (!gp->lakes && domain->lat->n >= 2)
+    if (!gp->lakes && nlat >= 2)
         gp->resolution = domain->lat->values[1] - domain->lat->values[0];
     else
         error("Cannot determine resolution\n");
 
-    qsort(cells, soil->n_cells, sizeof(struct soil_cell_s *),
-          compare_soil_cells);
-
-    domain->mask =
-        malloc(sizeof *domain->mask * domain->lat->n * domain->lon->n);
-    domain->area =
-        malloc(sizeof *domain->area * domain->lat->n * domain->lon->n);
-    domain->frac =
-        malloc(sizeof *domain->frac * domain->lat->n * domain->lon->n);
-
-    k = 0;
-    for (i = 0; i < domain->lat->n; i++)
-        for (j = 0; j < domain->lon->n; j++) {
-            int idx = i * domain->lon->n + j;
-            double lat = domain->lat->values[i], lon = domain->lon->values[j];
-
-            if (k < soil->n_cells && cells[k]->lat == lat &&
-                cells[k]->lon == lon) {
-                domain->mask[idx] = 1;
-                domain->area[idx] = calc_cell_area_m2(gp, lat, lon);
-                /* TODO: calculate frac, but classic input doesn't have this
-                 * info */
-                domain->frac[idx] = 1;
-                k++;
-            }
-            else {
-                domain->mask[idx] = 0;
-                domain->area[idx] = 0;
-                domain->frac[idx] = 0;
-            }
-        }
+    /* radix sort: a stable counting sort by lon and then by lat */
+    count = malloc(sizeof *count * ((nlat > nlon ? nlat : nlon) + 1));
+    by_lon = malloc(sizeof *by_lon * soil->n_cells);
+    order = malloc(sizeof *order * soil->n_cells);
+
+    for (i = 0; i <= nlon; i++)
+        count[i] = 0;
+    for (i = 0; i < soil->n_cells; i++)
+        count[lon_idx[i] + 1]++;
+    for (i = 0; i < nlon; i++)
+        count[i + 1] += count[i];
+    for (i = 0; i < soil->n_cells; i++)
+        by_lon[count[lon_idx[i]]++] = i;
+
+    for (i = 0; i <= nlat; i++)
+        count[i] = 0;
+    for (i = 0; i < soil->n_cells; i++)
+        count[lat_idx[i] + 1]++;
+    for (i = 0; i < nlat; i++)
+        count[i + 1] += count[i];
+
+    /* the row offsets are the index of the first cell in each lat row */
+    soil->lat_cells = malloc(sizeof *soil->lat_cells * (nlat + 1));
+    memcpy(soil->lat_cells, count, sizeof *soil->lat_cells * (nlat + 1));
+
+    for (i = 0; i < soil->n_cells; i++)
+        order[count[lat_idx[by_lon[i]]]++] = by_lon[i];
+
+    free(count);
+    free(by_lon);
+
+    domain->mask = malloc(sizeof *domain->mask * nlat * nlon);
+    domain->area = malloc(sizeof *domain->area * nlat * nlon);
+    domain->frac = malloc(sizeof *domain->frac * nlat * nlon);
+    for (i = 0; i < nlat * nlon; i++) {
+        domain->mask[i] = 0;
+        domain->area[i] = 0;
+        domain->frac[i] = 0;
+    }
 
-    return soil;
+    if (gp->cell_area != CELL_AREA)
+        row_areas = calc_row_areas_m2(gp, domain->lat);
+
+    soil->grid_idx = malloc(sizeof *soil->grid_idx * soil->n_cells);
+    for (k = 0; k < soil->n_cells; k++) {
+        int cell = order[k];
+        int idx = lat_idx[cell] * nlon + lon_idx[cell];
+
+        if (k && idx == soil->grid_idx[k - 1])
+            error("Duplicate grid cells %d and %d at lat %g, lon %g: %s\n",
+                  gridcel[order[k - 1]], gridcel[cell], lat[cell], lon[cell],
+                  gp->soil);
+
+        soil->grid_idx[k] = idx;
+        domain->mask[idx] = 1;
+        domain->area[idx] = row_areas ? row_areas[lat_idx[cell]] :
+            calc_cell_area_m2(gp, lat[cell], lon[cell]);
+        /* TODO: calculate frac, but classic input doesn't have this info */
+        domain->frac[idx] = 1;
+    }
+
+    free(lat_idx);
+    free(lon_idx);
+    free(row_areas);
+
+    return order;
 }
 
-static int compare_soil_cells(const void *p1, const void *p2)
+/* sort the values of axis and return the new position of each old one */
+static int *sort_axis(struct double_stack_s *axis)
 {
-    struct soil_cell_s *cell1 = *((struct soil_cell_s **)p1);
-    struct soil_cell_s *cell2 = *((struct soil_cell_s **)p2);
+    struct axis_value_s *values = malloc(sizeof *values * axis->n);
+    int *rank = malloc(sizeof *rank * axis->n);
+    int i;
+
+    for (i = 0; i < axis->n; i++) {
+        values[i].value = axis->values[i];
+        values[i].pos = i;
+    }
+
+    qsort(values, axis->n, sizeof *values, compare_axis_values);
+
+    for (i = 0; i < axis->n; i++) {
+        axis->values[i] = values[i].value;
+        rank[values[i].pos] = i;
+    }
+
+    free(values);
 
-    return cell1->lat > cell2->lat ? 1 : (cell1->lat <
-                                          cell2->lat ? -1 : (cell1->lon >
-                                                             cell2->lon) -
-                                          (cell1->lon < cell2->lon));
+    return rank;
+}
+
+static int compare_axis_values(const void *p1, const void *p2)
+{
+    const struct axis_value_s *v1 = p1, *v2 = p2;
+
+    return (v1->value > v2->value) - (v1->value < v2->value);
+}
+
+/* area of the cells of each lat row, which on a regular grid does not
+ * depend on the lon; the strips give the areas of calc_cell_area_m2() to
+ * within 1e-7 relative, the rounding of acos() at other lons, and the exact
+ * spherical band differs from them by about tan(lat) * resolution / 20 in
+ * radians, the error of the 10 strips, which grows to 9% in a cell that
+ * touches a pole */
+static double *calc_row_areas_m2(struct global_params_s *gp,
+                                 const struct double_stack_s *lat)
+{
+    double *areas = malloc(sizeof *areas * lat->n);
+    double half = gp->resolution / 2, dtor = 2.0 * M_PI / 360.0;
+    int i;
+
+    for (i = 0; i < lat->n; i++)
+        if (gp->equal_area || gp->cell_area != EXACT_AREA)
+            areas[i] = calc_cell_area_m2(gp, lat->values[i], 0);
+        else
+            areas[i] = CONST_REARTH * CONST_REARTH * dtor * gp->resolution *
+                fabs(sin(dtor * (lat->values[i] + half)) -
+                     sin(dtor * (lat->values[i] - half)));
+
+    return areas;
 }
 
 /* adopted from VIC/vic/drivers/classic/src/compute_cell_area.c */
@@ -317,31 +746,21 @@ static double calc_distance_m(double lat1, double lon1, double lat2,
 
 void free_soil(struct soil_s *soil)
 {
-    int i;
-
     free_double_stack_s(soil->domain->lat);
     free_double_stack_s(soil->domain->lon);
+    free(soil->domain->lat);
+    free(soil->domain->lon);
+    free(soil->domain->mask);
+    free(soil->domain->area);
+    free(soil->domain->frac);
     free(soil->domain);
 
-    for (i = 0; i < soil->n_cells; i++) {
-        free(soil->cells[i]->expt);
-        free(soil->cells[i]->Ksat);
-        free(soil->cells[i]->phi_s);
-        free(soil->cells[i]->init_moist);
-        free(soil->cells[i]->depth);
-        free(soil->cells[i]->bubble);
-        free(soil->cells[i]->quartz);
-        free(soil->cells[i]->bulk_density);
-        free(soil->cells[i]->soil_density);
-        free(soil->cells[i]->organic);
-        free(soil->cells[i]->bulk_dens_org);
-        free(soil->cells[i]->soil_dens_org);
-        free(soil->cells[i]->Wcr_FRACT);
-        free(soil->cells[i]->Wpwp_FRACT);
-        free(soil->cells[i]->resid_moist);
-        free(soil->cells[i]);
-    }
-
-    free(soil->cells);
+    if (soil->cells)
+        free_soil_table(soil->cells);
+    free(soil->lat_cells);
+    free(soil->grid_idx);
+    free(soil->offsets);
+    free(soil->run_cell);
+    free(soil->gridcels);
     free(soil);
 }
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include "global.h"
+#include "stats.h"
+
+static long peak_rss_kb(void);
+
+void init_stats_s(struct stats_s *stats)
+{
+    clock_gettime(CLOCK_MONOTONIC, &stats->start);
+    stats->n_phases = 0;
+}
+
+void start_stats_timer(struct stats_s *stats, struct timespec *start)
+{
+    if (stats)
+        clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+/* add the time since start and the counters to the named phase */
+void add_stats(struct stats_s *stats, const char *name,
+               struct timespec *start, long records, size_t bytes)
+{
+    struct timespec end;
+
+    if (!stats)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    add_stats_seconds(stats, name, end.tv_sec - start->tv_sec +
+                      (end.tv_nsec - start->tv_nsec) / 1e9, records, bytes);
+}
+
+void add_stats_seconds(struct stats_s *stats, const char *name,
+                       double seconds, long records, size_t bytes)
+{
+    struct stats_phase_s *phase;
+    int i;
+
+    if (!stats)
+        return;
+
+    for (i = 0; i < stats->n_phases; i++)
+        if (strcmp(stats->phases[i].name, name) == 0)
+            break;
+    phase = &stats->phases[i];
+    if (i == stats->n_phases) {
+        if (stats->n_phases == MAX_STATS_PHASES)
+            error("Too many stats phases: %s\n", name);
+        stats->n_phases++;
+        memset(phase, 0, sizeof *phase);
+        phase->name = name;
+    }
+
+    phase->calls++;
+    phase->seconds += seconds;
+    phase->records += records;
+    phase->bytes += bytes;
+    phase->peak_rss_kb = peak_rss_kb();
+}
+
+/* size of an input or output file, read only for the report */
+size_t stats_file_size(struct stats_s *stats, const char *path)
+{
+    struct stat st;
+
+    if (!stats || stat(path, &st))
+        return 0;
+
+    return st.st_size;
+}
+
+/* write the phases in the order they were first added as JSON to path, or
+ * to standard output if it is - */
+void write_stats(struct stats_s *stats, const char *path)
+{
+    struct timespec end;
+    FILE *fp;
+    int i;
+
+    if (!stats)
+        return;
+
+    if (strcmp(path, "-") == 0)
+        fp = stdout;
+    else if (!(fp = fopen(path, "w")))
+        error("Cannot create file: %s\n", path);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(fp, "{\n  \"seconds\": %.6f,\n  \"peak_rss_kb\": %ld,\n",
+            end.tv_sec - stats->start.tv_sec +
+            (end.tv_nsec - stats->start.tv_nsec) / 1e9, peak_rss_kb());
+    fprintf(fp, "  \"phases\": [");
+    for (i = 0; i < stats->n_phases; i++) {
+        struct stats_phase_s *phase = &stats->phases[i];
+
+        fprintf(fp, "%s\n    {\"name\": \"%s\", \"calls\": %d, "
+                "\"seconds\": %.6f, \"records\": %ld, \"bytes\": %zu, "
+                "\"records_per_s\": %.1f, \"mb_per_s\": %.3f, "
+                "\"peak_rss_kb\": %ld}", i ? "," : "", phase->name,
+                phase->calls, phase->seconds, phase->records, phase->bytes,
+                phase->seconds > 0 ? phase->records / phase->seconds : 0,
+                phase->seconds > 0 ? phase->bytes / 1e6 / phase->seconds : 0,
+                phase->peak_rss_kb);
+    }
+    fprintf(fp, "\n  ]\n}\n");
+
+    if (fp != stdout && fclose(fp))
+        error("Cannot write file: %s\n", path);
+}
+
+/* ru_maxrss is in kilobytes on Linux */
+static long peak_rss_kb(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    return usage.ru_maxrss;
+}
@@ -0,0 +1,31 @@
+#define MAX_STATS_PHASES 32
+
+/* time, counters and peak memory of a phase of the conversion; a phase
+ * added several times, such as a stage of each block, accumulates */
+struct stats_phase_s
+{
+    const char *name;
+    int calls;
+    double seconds;
+    long records;               /* lines, cells or files */
+    size_t bytes;
+    long peak_rss_kb;           /* of the process when it last ended */
+};
+
+/* --stats report; the functions do nothing if it is NULL, so that without
+ * the option no clock or counter is read */
+struct stats_s
+{
+    struct timespec start;
+    int n_phases;
+    struct stats_phase_s phases[MAX_STATS_PHASES];
+};
+
+/* stats.c */
+void init_stats_s(struct stats_s *);
+void start_stats_timer(struct stats_s *, struct timespec *);
+void add_stats(struct stats_s *, const char *, struct timespec *, long,
+               size_t);
+void add_stats_seconds(struct stats_s *, const char *, double, long, size_t);
+size_t stats_file_size(struct stats_s *, const char *);
+void write_stats(struct stats_s *, const char *);
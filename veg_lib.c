@@ -4,36 +4,54 @@
 #include <math.h>
 #include "global.h"
 #include "double_stack.h"
+#include "arena.h"
+#include "line_reader.h"
+#include "parser.h"
 #include "vic.h"
 
-#define swapbuf() do { char *p = p1; p1 = p2; p2 = p; } while(0)
-static char buf1[BUF_SIZE], buf2[BUF_SIZE], *p1 = buf1, *p2 = buf2;
+/* the direct-index table of veg_class numbers may be at most this many
+ * times the number of classes */
+#define MAX_CLASS_IDX_RATIO 4
+
+/* a class by veg_class for sorting */
+struct veg_class_idx_s
+{
+    int veg_class;
+    int idx;
+};
+
+static void index_veg_lib(struct veg_lib_s *);
+static int compare_veg_class_idx(const void *, const void *);
 
 struct veg_lib_s *read_classic_veg_lib(struct global_params_s *gp)
 {
     struct veg_lib_s *veg_lib;
     struct veg_class_s **classes;
-    FILE *fp;
+    struct line_reader_s reader;
+    struct parser_s parser;
+    char *line;
     int nalloc;
 
-    if (!(fp = fopen(gp->veglib, "r")))
-        error("Cannot open file: %s\n", gp->veglib);
+    open_line_reader(&reader, gp->veglib);
 
     nalloc = 0;
 
     veg_lib = malloc(sizeof *veg_lib);
+    veg_lib->arena = malloc(sizeof *veg_lib->arena);
+    init_arena_s(veg_lib->arena);
     veg_lib->n_classes = 0;
     veg_lib->classes = classes = NULL;
 
-    while (fgets(p1, BUF_SIZE, fp)) {
+    init_parser_s(&parser, &reader);
+
+    while ((line = read_line(&reader))) {
         struct veg_class_s *class;
-        int overstory;
+        char *comment;
+        size_t length;
         int i;
 
-        if (p1[0] == '#' || p1[0] == '\r' || p1[0] == '\n' || !p1[0])
-            continue;
-
-        if (sscanf(p1, "%s", p2) != 1 || p2[0] == '#' || !p2[0])
+        parse_line(&parser, line);
+        if (is_blank_line(&parser))
             continue;
 
         if (veg_lib->n_classes == nalloc) {
@@ -41,89 +59,177 @@ struct veg_lib_s *read_classic_veg_lib(struct global_params_s *gp)
             veg_lib->classes = classes =
                 realloc(classes, sizeof *classes * nalloc);
         }
-        classes[veg_lib->n_classes++] = class = malloc(sizeof *class);
+        classes[veg_lib->n_classes++] = class =
+            arena_alloc(veg_lib->arena, sizeof *class);
 
-        sscanf(p1, "%d %d %lf %lf %[^\r\n]", &class->veg_class,
-               &overstory, &class->rarc, &class->rmin, p2);
-        swapbuf();
-        class->overstory = overstory;
+        class->veg_class = parse_int(&parser);
+        class->overstory = parse_int(&parser);
+        class->rarc = parse_double(&parser);
+        class->rmin = parse_double(&parser);
 
-        class->LAI = malloc(sizeof *class->LAI * 12);
-        for (i = 0; i < 12; i++) {
-            sscanf(p1, "%lf %[^\r\n]", &class->LAI[i], p2);
-            swapbuf();
-        }
+        class->LAI = arena_alloc(veg_lib->arena, sizeof *class->LAI * 12);
+        for (i = 0; i < 12; i++)
+            class->LAI[i] = parse_double(&parser);
 
         if (gp->veglib_fcan) {
-            class->FCANOPY = malloc(sizeof *class->FCANOPY * 12);
-            for (i = 0; i < 12; i++) {
-                sscanf(p1, "%lf %[^\r\n]", &class->FCANOPY[i], p2);
-                swapbuf();
-            }
+            class->FCANOPY =
+                arena_alloc(veg_lib->arena, sizeof *class->FCANOPY * 12);
+            for (i = 0; i < 12; i++)
+                class->FCANOPY[i] = parse_double(&parser);
         }
         else
             class->FCANOPY = NULL;
 
-        class->albedo = malloc(sizeof *class->albedo * 12);
-        for (i = 0; i < 12; i++) {
-            sscanf(p1, "%lf %[^\r\n]", &class->albedo[i], p2);
-            swapbuf();
-        }
+        class->albedo =
+            arena_alloc(veg_lib->arena, sizeof *class->albedo * 12);
+        for (i = 0; i < 12; i++)
+            class->albedo[i] = parse_double(&parser);
 
-        class->rough = malloc(sizeof *class->rough * 12);
-        for (i = 0; i < 12; i++) {
-            sscanf(p1, "%lf %[^\r\n]", &class->rough[i], p2);
-            swapbuf();
-        }
+        class->rough = arena_alloc(veg_lib->arena, sizeof *class->rough * 12);
+        for (i = 0; i < 12; i++)
+            class->rough[i] = parse_double(&parser);
 
-        class->displacement = malloc(sizeof *class->displacement * 12);
-        for (i = 0; i < 12; i++) {
-            sscanf(p1, "%lf %[^\r\n]", &class->displacement[i], p2);
-            swapbuf();
-        }
+        class->displacement =
+            arena_alloc(veg_lib->arena, sizeof *class->displacement * 12);
+        for (i = 0; i < 12; i++)
+            class->displacement[i] = parse_double(&parser);
 
-        sscanf(p1, "%lf %lf %lf %lf %lf %[^\r\n]", &class->wind_h,
-               &class->RGL, &class->rad_atten, &class->wind_atten,
-               &class->trunk_ratio, p2);
-        swapbuf();
+        class->wind_h = parse_double(&parser);
+        class->RGL = parse_double(&parser);
+        class->rad_atten = parse_double(&parser);
+        class->wind_atten = parse_double(&parser);
+        class->trunk_ratio = parse_double(&parser);
 
         if (gp->veglib_photo) {
-            int NscaleFlag;
-
-            sscanf(p1, "%d %lf %lf %lf %d %lf %lf %[^\r\n]", &class->Ctype,
-                   &class->MaxCarboxRate, &class->MaxETransport,
-                   &class->LightUseEff, &NscaleFlag, &class->Wnpp_inhib,
-                   &class->NPPfactor_sat, p2);
-            swapbuf();
-            class->NscaleFlag = NscaleFlag;
+            class->Ctype = parse_int(&parser);
+            class->MaxCarboxRate = parse_double(&parser);
+            class->MaxETransport = parse_double(&parser);
+            class->LightUseEff = parse_double(&parser);
+            class->NscaleFlag = parse_int(&parser);
+            class->Wnpp_inhib = parse_double(&parser);
+            class->NPPfactor_sat = parse_double(&parser);
         }
 
-        class->comment = malloc(strlen(p1) + 1);
-        strcpy(class->comment, p1);
+        comment = parse_rest(&parser, &length);
+        class->comment = arena_alloc(veg_lib->arena, length + 1);
+        memcpy(class->comment, comment, length);
+        class->comment[length] = 0;
     }
 
-    if (ferror(fp))
-        error("Cannot read file: %s\n", gp->veglib);
+    close_line_reader(&reader);
 
-    fclose(fp);
+    index_veg_lib(veg_lib);
 
     return veg_lib;
 }
 
-void free_veg_lib(struct veg_lib_s *veg_lib)
+/* return the index of veg_class in veg_lib->classes or -1 */
+int find_veg_class(struct veg_lib_s *veg_lib, int veg_class)
 {
+    int lo, hi, mid;
     int i;
 
-    for (i = 0; i < veg_lib->n_classes; i++) {
-        free(veg_lib->classes[i]->LAI);
-        free(veg_lib->classes[i]->FCANOPY);
-        free(veg_lib->classes[i]->albedo);
-        free(veg_lib->classes[i]->rough);
-        free(veg_lib->classes[i]->displacement);
-        free(veg_lib->classes[i]->comment);
-        free(veg_lib->classes[i]);
+    if (veg_lib->veg_class_ids) {
+        lo = 0;
+        hi = veg_lib->n_class_idx;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (veg_lib->veg_class_ids[mid] < veg_class)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo == veg_lib->n_class_idx ||
+            veg_lib->veg_class_ids[lo] != veg_class)
+            return -1;
+        return veg_lib->class_idx[lo];
     }
 
+    i = veg_class - veg_lib->min_veg_class;
+    if (i < 0 || i >= veg_lib->n_class_idx)
+        return -1;
+
+    return veg_lib->class_idx[i];
+}
+
+/* veg_class numbers are usually small, so a direct-index table is enough;
+ * sparse ones are sorted and searched instead */
+static void index_veg_lib(struct veg_lib_s *veg_lib)
+{
+    struct veg_class_idx_s *sorted;
+    int max_veg_class;
+    int i, n;
+
+    veg_lib->min_veg_class = veg_lib->n_class_idx = 0;
+    veg_lib->class_idx = NULL;
+    veg_lib->veg_class_ids = NULL;
+
+    if (veg_lib->n_classes <= 0)
+        return;
+
+    veg_lib->min_veg_class = max_veg_class =
+        veg_lib->classes[0]->veg_class;
+    for (i = 1; i < veg_lib->n_classes; i++) {
+        if (veg_lib->classes[i]->veg_class < veg_lib->min_veg_class)
+            veg_lib->min_veg_class = veg_lib->classes[i]->veg_class;
+        if (veg_lib->classes[i]->veg_class > max_veg_class)
+            max_veg_class = veg_lib->classes[i]->veg_class;
+    }
+
+    /* in long long as the range of two ints can overflow an int */
+    if ((long long)max_veg_class - veg_lib->min_veg_class >=
+        (long long)MAX_CLASS_IDX_RATIO * veg_lib->n_classes) {
+        sorted = malloc(sizeof *sorted * veg_lib->n_classes);
+        for (i = 0; i < veg_lib->n_classes; i++) {
+            sorted[i].veg_class = veg_lib->classes[i]->veg_class;
+            sorted[i].idx = i;
+        }
+        qsort(sorted, veg_lib->n_classes, sizeof *sorted,
+              compare_veg_class_idx);
+
+        /* the first class wins as in a linear scan */
+        veg_lib->veg_class_ids =
+            malloc(sizeof *veg_lib->veg_class_ids * veg_lib->n_classes);
+        veg_lib->class_idx =
+            malloc(sizeof *veg_lib->class_idx * veg_lib->n_classes);
+        for (i = n = 0; i < veg_lib->n_classes; i++) {
+            if (n && veg_lib->veg_class_ids[n - 1] == sorted[i].veg_class)
+                continue;
+            veg_lib->veg_class_ids[n] = sorted[i].veg_class;
+            veg_lib->class_idx[n++] = sorted[i].idx;
+        }
+        veg_lib->n_class_idx = n;
+        free(sorted);
+        return;
+    }
+
+    veg_lib->n_class_idx = max_veg_class - veg_lib->min_veg_class + 1;
+    veg_lib->class_idx =
+        malloc(sizeof *veg_lib->class_idx * veg_lib->n_class_idx);
+    for (i = 0; i < veg_lib->n_class_idx; i++)
+        veg_lib->class_idx[i] = -1;
+
+    /* the first class wins as in a linear scan */
+    for (i = veg_lib->n_classes - 1; i >= 0; i--)
+        veg_lib->class_idx[veg_lib->classes[i]->veg_class -
+                           veg_lib->min_veg_class] = i;
+}
+
+static int compare_veg_class_idx(const void *a, const void *b)
+{
+    const struct veg_class_idx_s *x = a, *y = b;
+
+    if (x->veg_class != y->veg_class)
+        return x->veg_class < y->veg_class ? -1 : 1;
+    return x->idx - y->idx;
+}
+
+void free_veg_lib(struct veg_lib_s *veg_lib)
+{
+    free_arena_s(veg_lib->arena);
+    free(veg_lib->arena);
     free(veg_lib->classes);
+    free(veg_lib->class_idx);
+    free(veg_lib->veg_class_ids);
     free(veg_lib);
 }
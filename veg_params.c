@@ -2,190 +2,351 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
 #include "global.h"
 #include "double_stack.h"
+#include "arena.h"
+#include "gridcel_index.h"
+#include "line_reader.h"
+#include "parser.h"
 #include "vic.h"
 
-#define swapbuf() do { char *p = p1; p1 = p2; p2 = p; } while(0)
-static char buf1[BUF_SIZE], buf2[BUF_SIZE], *p1 = buf1, *p2 = buf2;
-
+/* cells [first, last) parsed by one thread with its own arena */
+struct veg_chunk_s
+{
+    struct global_params_s *gp;
+    struct veg_params_s *veg_params;
+    struct line_reader_s reader;
+    struct arena_s *arena;
+    int first, last;
+};
+
+static struct veg_params_s *scan_veg_params(struct global_params_s *,
+                                            struct line_reader_s *);
+static void *read_veg_chunk(void *);
+static void read_veg_cell(struct global_params_s *, struct parser_s *,
+                          struct arena_s *, struct veg_cell_s *);
+static void read_veg_line(struct global_params_s *, struct parser_s *);
+static void index_veg_params(struct veg_params_s *);
+
+/* the cell headers are found by a scan that skips the lines of their tiles
+ * and then the cells are parsed in parallel into one array */
 struct veg_params_s *read_classic_veg_params(struct global_params_s *gp)
 {
     struct veg_params_s *veg_params;
-    struct veg_cell_s **cells;
-    FILE *fp;
-    int nalloc;
+    struct line_reader_s reader;
+    struct veg_chunk_s *chunks;
+    pthread_t *threads;
+    int n_chunks = gp->threads > 1 ? gp->threads : 1;
+    int i;
+
+    open_line_reader(&reader, gp->vegparam);
+
+    veg_params = scan_veg_params(gp, &reader);
+    veg_params->cells = malloc(sizeof *veg_params->cells *
+                               veg_params->n_cells);
+    veg_params->n_arenas = n_chunks;
+    veg_params->arenas = malloc(sizeof *veg_params->arenas * n_chunks);
+
+    chunks = malloc(sizeof *chunks * n_chunks);
+    threads = malloc(sizeof *threads * n_chunks);
+
+    for (i = 0; i < n_chunks; i++) {
+        chunks[i].gp = gp;
+        chunks[i].veg_params = veg_params;
+        chunks[i].reader = reader;
+        chunks[i].arena = &veg_params->arenas[i];
+        chunks[i].first = (long)veg_params->n_cells * i / n_chunks;
+        chunks[i].last = (long)veg_params->n_cells * (i + 1) / n_chunks;
+        init_arena_s(chunks[i].arena);
+    }
+
+    if (n_chunks == 1)
+        read_veg_chunk(&chunks[0]);
+    else {
+        for (i = 0; i < n_chunks; i++)
+            if (pthread_create(&threads[i], NULL, read_veg_chunk,
+                               &chunks[i]))
+                error("Cannot create thread\n");
+        for (i = 0; i < n_chunks; i++)
+            pthread_join(threads[i], NULL);
+    }
+
+    free(threads);
+    free(chunks);
+
+    close_line_reader(&reader);
+
+    /* the offsets are only needed in streaming mode */
+    free(veg_params->offsets);
+    veg_params->offsets = NULL;
+
+    index_veg_params(veg_params);
+
+    return veg_params;
+}
+
+/* first pass of the streaming mode */
+struct veg_params_s *scan_classic_veg_params(struct global_params_s *gp)
+{
+    struct veg_params_s *veg_params;
+    struct line_reader_s reader;
+
+    open_line_reader(&reader, gp->vegparam);
+
+    veg_params = scan_veg_params(gp, &reader);
+
+    close_line_reader(&reader);
+
+    index_veg_params(veg_params);
+
+    return veg_params;
+}
 
-    if (!(fp = fopen(gp->vegparam, "r")))
-        error("Cannot open file: %s\n", gp->vegparam);
+/* record the gridcel and file offset of every cell header; the Nveg tiles
+ * of each cell are skipped by their line count without parsing them */
+static struct veg_params_s *scan_veg_params(struct global_params_s *gp,
+                                            struct line_reader_s *reader)
+{
+    struct veg_params_s *veg_params;
+    struct parser_s parser;
+    char *line;
+    int lines_per_veg;
+    int nalloc;
 
     nalloc = 0;
 
     veg_params = malloc(sizeof *veg_params);
     veg_params->root_zones = gp->root_zones;
+    veg_params->n_arenas = 0;
+    veg_params->arenas = NULL;
     veg_params->n_cells = 0;
-    veg_params->cells = cells = NULL;
+    veg_params->cells = NULL;
+    veg_params->gridcels = NULL;
+    veg_params->offsets = NULL;
 
-    while (fgets(p1, BUF_SIZE, fp)) {
-        struct veg_cell_s *cell;
-        int i;
+    lines_per_veg =
+        1 + gp->vegparam_lai + gp->vegparam_fcan + gp->vegparam_alb;
 
-        if (p1[0] == '#' || p1[0] == '\r' || p1[0] == '\n' || !p1[0])
-            continue;
+    init_parser_s(&parser, reader);
 
-        if (sscanf(p1, "%s", p2) != 1 || p2[0] == '#' || !p2[0])
+    while ((line = read_line(reader))) {
+        int Nveg, i;
+
+        parse_line(&parser, line);
+        if (is_blank_line(&parser))
             continue;
 
         if (veg_params->n_cells == nalloc) {
             nalloc += REALLOC_INCREMENT;
-            veg_params->cells = cells =
-                realloc(cells, sizeof *cells * nalloc);
+            veg_params->gridcels =
+                realloc(veg_params->gridcels,
+                        sizeof *veg_params->gridcels * nalloc);
+            veg_params->offsets =
+                realloc(veg_params->offsets,
+                        sizeof *veg_params->offsets * nalloc);
         }
-        cells[veg_params->n_cells++] = cell = malloc(sizeof *cell);
 
-        sscanf(p1, "%d %d", &cell->gridcel, &cell->Nveg);
+        veg_params->gridcels[veg_params->n_cells] = parse_int(&parser);
+        Nveg = parse_int(&parser);
+        veg_params->offsets[veg_params->n_cells++] = reader->offset;
 
-        if (!cell->Nveg) {
-            cell->veg_class = NULL;
-            cell->Cv = NULL;
-            cell->root_depth = cell->root_fract = NULL;
-            cell->LAI = cell->FCANOPY = cell->ALBEDO = NULL;
-            continue;
-        }
+        for (i = 0; i < Nveg * lines_per_veg; i++)
+            read_veg_line(gp, &parser);
+    }
 
-        cell->veg_class = malloc(sizeof *cell->veg_class * cell->Nveg);
-        cell->Cv = malloc(sizeof *cell->Cv * cell->Nveg);
-        cell->root_depth = malloc(sizeof *cell->root_depth * cell->Nveg);
-        cell->root_fract = malloc(sizeof *cell->root_fract * cell->Nveg);
+    return veg_params;
+}
 
-        if (gp->blowing) {
-            cell->sigma_slope =
-                malloc(sizeof *cell->sigma_slope * cell->Nveg);
-            cell->lag_one = malloc(sizeof *cell->lag_one * cell->Nveg);
-            cell->fetch = malloc(sizeof *cell->fetch * cell->Nveg);
-        }
-        else {
-            cell->sigma_slope = NULL;
-            cell->lag_one = NULL;
-            cell->fetch = NULL;
-        }
+/* parse the cells of a chunk from their offsets */
+static void *read_veg_chunk(void *arg)
+{
+    struct veg_chunk_s *chunk = arg;
+    int i;
 
-        if (gp->vegparam_lai)
-            cell->LAI = malloc(sizeof *cell->LAI * cell->Nveg);
-        else
-            cell->LAI = NULL;
+    for (i = chunk->first; i < chunk->last; i++)
+        read_veg_cell_at(chunk->gp, &chunk->reader,
+                         chunk->veg_params->offsets[i], chunk->arena,
+                         &chunk->veg_params->cells[i]);
 
-        if (gp->vegparam_fcan)
-            cell->FCANOPY = malloc(sizeof *cell->FCANOPY * cell->Nveg);
-        else
-            cell->FCANOPY = NULL;
+    return NULL;
+}
 
-        if (gp->vegparam_alb)
-            cell->ALBEDO = malloc(sizeof *cell->ALBEDO * cell->Nveg);
-        else
-            cell->ALBEDO = NULL;
-
-        for (i = 0; i < cell->Nveg; i++) {
-            int j;
-
-            if (!fgets(p1, BUF_SIZE, fp))
-                error("Incorrect format: %s\n", gp->vegparam);
-
-            sscanf(p1, "%d %lf %[^\r\n]", &cell->veg_class[i], &cell->Cv[i],
-                   p2);
-            swapbuf();
-
-            if (veg_params->root_zones) {
-                cell->root_depth[i] =
-                    malloc(sizeof *cell->root_depth[i] *
-                           veg_params->root_zones);
-                cell->root_fract[i] =
-                    malloc(sizeof *cell->root_fract[i] *
-                           veg_params->root_zones);
-
-                for (j = 0; j < veg_params->root_zones; j++) {
-                    sscanf(p1, "%lf %lf %[^\r\n]", &cell->root_depth[i][j],
-                           &cell->root_fract[i][j], p2);
-                    swapbuf();
-                }
-            }
-            else
-                cell->root_depth[i] = cell->root_fract[i] = NULL;
-
-            if (gp->blowing)
-                sscanf(p1, "%lf %lf %lf", &cell->sigma_slope[i],
-                       &cell->lag_one[i], &cell->fetch[i]);
-
-            if (gp->vegparam_lai) {
-                if (!fgets(p1, BUF_SIZE, fp))
-                    error("Incorrect format: %s\n", gp->vegparam);
-
-                cell->LAI[i] = malloc(sizeof *cell->LAI[i] * 12);
-                for (j = 0; j < 12; j++) {
-                    sscanf(p1, "%lf %[^\r\n]", &cell->LAI[i][j], p2);
-                    swapbuf();
-                }
-            }
+/* second pass of the streaming mode: read the cell at offset into cell
+ * with its per-tile arrays allocated from arena */
+void read_veg_cell_at(struct global_params_s *gp,
+                      struct line_reader_s *reader, long offset,
+                      struct arena_s *arena, struct veg_cell_s *cell)
+{
+    struct parser_s parser;
+    char *line;
 
-            if (gp->vegparam_fcan) {
-                if (!fgets(p1, BUF_SIZE, fp))
-                    error("Incorrect format: %s\n", gp->vegparam);
+    seek_line(reader, offset);
+    if (!(line = read_line(reader)))
+        error("Cannot read file: %s\n", gp->vegparam);
 
-                cell->FCANOPY[i] = malloc(sizeof *cell->FCANOPY[i] * 12);
-                for (j = 0; j < 12; j++) {
-                    sscanf(p1, "%lf %[^\r\n]", &cell->FCANOPY[i][j], p2);
-                    swapbuf();
-                }
-            }
+    init_parser_s(&parser, reader);
+    parse_line(&parser, line);
+    read_veg_cell(gp, &parser, arena, cell);
+}
+
+/* parse the cell header on the line of parser and the Nveg tiles on the
+ * lines that follow it */
+static void read_veg_cell(struct global_params_s *gp, struct parser_s *parser,
+                          struct arena_s *arena, struct veg_cell_s *cell)
+{
+    int i;
+
+    cell->gridcel = parse_int(parser);
+    cell->Nveg = parse_int(parser);
+
+    if (!cell->Nveg) {
+        cell->veg_class = NULL;
+        cell->Cv = NULL;
+        cell->root_depth = cell->root_fract = NULL;
+        cell->sigma_slope = cell->lag_one = cell->fetch = NULL;
+        cell->LAI = cell->FCANOPY = cell->ALBEDO = NULL;
+        return;
+    }
+
+    cell->veg_class = arena_alloc(arena, sizeof *cell->veg_class * cell->Nveg);
+    cell->Cv = arena_alloc(arena, sizeof *cell->Cv * cell->Nveg);
+    cell->root_depth =
+        arena_alloc(arena, sizeof *cell->root_depth * cell->Nveg);
+    cell->root_fract =
+        arena_alloc(arena, sizeof *cell->root_fract * cell->Nveg);
+
+    if (gp->blowing) {
+        cell->sigma_slope =
+            arena_alloc(arena, sizeof *cell->sigma_slope * cell->Nveg);
+        cell->lag_one = arena_alloc(arena, sizeof *cell->lag_one * cell->Nveg);
+        cell->fetch = arena_alloc(arena, sizeof *cell->fetch * cell->Nveg);
+    }
+    else {
+        cell->sigma_slope = NULL;
+        cell->lag_one = NULL;
+        cell->fetch = NULL;
+    }
 
-            if (gp->vegparam_alb) {
-                if (!fgets(p1, BUF_SIZE, fp))
-                    error("Incorrect format: %s\n", gp->vegparam);
+    if (gp->vegparam_lai)
+        cell->LAI = arena_alloc(arena, sizeof *cell->LAI * cell->Nveg);
+    else
+        cell->LAI = NULL;
 
-                cell->ALBEDO[i] = malloc(sizeof *cell->ALBEDO[i] * 12);
-                for (j = 0; j < 12; j++) {
-                    sscanf(p1, "%lf %[^\r\n]", &cell->ALBEDO[i][j], p2);
-                    swapbuf();
-                }
+    if (gp->vegparam_fcan)
+        cell->FCANOPY = arena_alloc(arena, sizeof *cell->FCANOPY * cell->Nveg);
+    else
+        cell->FCANOPY = NULL;
+
+    if (gp->vegparam_alb)
+        cell->ALBEDO = arena_alloc(arena, sizeof *cell->ALBEDO * cell->Nveg);
+    else
+        cell->ALBEDO = NULL;
+
+    for (i = 0; i < cell->Nveg; i++) {
+        int j;
+
+        read_veg_line(gp, parser);
+        cell->veg_class[i] = parse_int(parser);
+        cell->Cv[i] = parse_double(parser);
+
+        if (gp->root_zones) {
+            cell->root_depth[i] =
+                arena_alloc(arena,
+                            sizeof *cell->root_depth[i] * gp->root_zones);
+            cell->root_fract[i] =
+                arena_alloc(arena,
+                            sizeof *cell->root_fract[i] * gp->root_zones);
+
+            for (j = 0; j < gp->root_zones; j++) {
+                cell->root_depth[i][j] = parse_double(parser);
+                cell->root_fract[i][j] = parse_double(parser);
             }
         }
+        else
+            cell->root_depth[i] = cell->root_fract[i] = NULL;
+
+        if (gp->blowing) {
+            cell->sigma_slope[i] = parse_double(parser);
+            cell->lag_one[i] = parse_double(parser);
+            cell->fetch[i] = parse_double(parser);
+        }
+
+        if (gp->vegparam_lai) {
+            read_veg_line(gp, parser);
+
+            cell->LAI[i] = arena_alloc(arena, sizeof *cell->LAI[i] * 12);
+            for (j = 0; j < 12; j++)
+                cell->LAI[i][j] = parse_double(parser);
+        }
+
+        if (gp->vegparam_fcan) {
+            read_veg_line(gp, parser);
+
+            cell->FCANOPY[i] =
+                arena_alloc(arena, sizeof *cell->FCANOPY[i] * 12);
+            for (j = 0; j < 12; j++)
+                cell->FCANOPY[i][j] = parse_double(parser);
+        }
+
+        if (gp->vegparam_alb) {
+            read_veg_line(gp, parser);
+
+            cell->ALBEDO[i] = arena_alloc(arena, sizeof *cell->ALBEDO[i] * 12);
+            for (j = 0; j < 12; j++)
+                cell->ALBEDO[i][j] = parse_double(parser);
+        }
     }
+}
 
-    if (ferror(fp))
-        error("Cannot read file: %s\n", gp->vegparam);
+/* start parsing the next line of a cell */
+static void read_veg_line(struct global_params_s *gp, struct parser_s *parser)
+{
+    char *line;
 
-    fclose(fp);
+    if (!(line = read_line(parser->reader)))
+        error("Incorrect format: %s\n", gp->vegparam);
 
-    return veg_params;
+    parse_line(parser, line);
+}
+
+/* return the first cell with gridcel or NULL */
+struct veg_cell_s *find_veg_cell(struct veg_params_s *veg_params,
+                                 int gridcel)
+{
+    int i = find_gridcel(veg_params->cell_idx, gridcel);
+
+    return i < 0 ? NULL : &veg_params->cells[i];
+}
+
+/* return the file offset of the first cell with gridcel or -1 in the
+ * streaming mode */
+long find_veg_cell_offset(struct veg_params_s *veg_params, int gridcel)
+{
+    int i = find_gridcel(veg_params->cell_idx, gridcel);
+
+    return i < 0 ? -1 : veg_params->offsets[i];
+}
+
+static void index_veg_params(struct veg_params_s *veg_params)
+{
+    veg_params->cell_idx = malloc(sizeof *veg_params->cell_idx);
+    init_gridcel_index_s(veg_params->cell_idx, veg_params->gridcels,
+                         veg_params->n_cells);
 }
 
 void free_veg_params(struct veg_params_s *veg_params)
 {
     int i;
 
-    for (i = 0; i < veg_params->n_cells; i++) {
-        int j;
-
-        free(veg_params->cells[i]->veg_class);
-        free(veg_params->cells[i]->Cv);
-        for (j = 0; j < veg_params->cells[i]->Nveg; j++) {
-            free(veg_params->cells[i]->root_depth[j]);
-            free(veg_params->cells[i]->root_fract[j]);
-            if (veg_params->cells[i]->LAI)
-                free(veg_params->cells[i]->LAI[j]);
-            if (veg_params->cells[i]->FCANOPY)
-                free(veg_params->cells[i]->FCANOPY[j]);
-            if (veg_params->cells[i]->ALBEDO)
-                free(veg_params->cells[i]->ALBEDO[j]);
-        }
-        free(veg_params->cells[i]->root_depth);
-        free(veg_params->cells[i]->root_fract);
-        free(veg_params->cells[i]->LAI);
-        free(veg_params->cells[i]->FCANOPY);
-        free(veg_params->cells[i]->ALBEDO);
-        free(veg_params->cells[i]);
-    }
+    for (i = 0; i < veg_params->n_arenas; i++)
+        free_arena_s(&veg_params->arenas[i]);
+    free(veg_params->arenas);
 
     free(veg_params->cells);
+    free(veg_params->gridcels);
+    free(veg_params->offsets);
+    free_gridcel_index_s(veg_params->cell_idx);
+    free(veg_params->cell_idx);
     free(veg_params);
 }
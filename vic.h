@@ -2,8 +2,12 @@
 #define _VIC_H_
 
 #include <stdbool.h>
+#include <sys/types.h>
 #include "global.h"
 
+struct line_reader_s;
+struct gridcel_index_s;
+
 #define MAX_LAKE_NODES 20
 /* VIC/vic/vic_run/include/vic_physical_constants.h */
 #define CONST_REARTH 6.37122e6  /* radius of the Earth in m */
@@ -56,6 +60,14 @@ enum rc_mode
     RC_PHOTO
 };
 
+/* how the area of the cells is calculated */
+enum cell_area
+{
+    ROW_AREA,                   /* default; the strips once per lat row */
+    CELL_AREA,                  /* the strips for each cell */
+    EXACT_AREA                  /* the spherical band of each lat row */
+};
+
 enum file_format
 {
     /* for classic driver */
@@ -275,10 +287,16 @@ struct global_params_s
     int stateday;
     int statesec;
     enum file_format state_format;
+    /* for image driver */
+    char *image_state;          /* prefix for the converted INIT_STATE */
+    /* end of image driver */
 
     /* meteorological and vegetation forcing files */
     char *forcing1;             /* input text/NetCDF */
     char *forcing2;             /* input text/NetCDF */
+    /* for image driver */
+    char *image_forcing[2];     /* prefix for yearly output NetCDF */
+    /* end of image driver */
     /* for classic driver */
     enum file_format force_format;
     enum endian force_endian;
@@ -344,6 +362,9 @@ struct global_params_s
     char *result_dir;
     int n_outfiles;             /* internal */
     char **outfile;             /* prefix for output text/NetCDF */
+    /* for image driver */
+    char *image_history;        /* prefix for history output NetCDF */
+    /* end of image driver */
     struct freq_s **aggfreq;    /* default NDAYS */
     /* for image driver */
     struct freq_s **histfreq;   /* default to one single file */
@@ -353,6 +374,21 @@ struct global_params_s
     enum file_format *out_format;       /* default ASCII */
     int *n_outvars;             /* internal */
     struct outvar_s ***outvar;
+
+    /* conversion options */
+    size_t max_memory;          /* 0 to read all cells in memory;
+                                 * else bytes per block in streaming mode */
+    int threads;                /* threads that parse the soil and
+                                 * vegparam files */
+    bool forcing;               /* convert the forcing files too */
+    bool history;               /* convert the output files too */
+    bool state;                 /* convert INIT_STATE too */
+    int io_threads;             /* threads that read the forcing and
+                                 * output files */
+    int compress_level;         /* 0 for classic parameters and domain
+                                 * files; else NetCDF-4 deflate level */
+    enum cell_area cell_area;
+    struct stats_s *stats;      /* NULL without --stats */
 };
 
 struct domain_s
@@ -364,52 +400,62 @@ struct domain_s
     double *frac;
 };
 
-struct soil_cell_s
+/* soil parameters with one array per field; per-layer fields are laid out
+ * [nlayer][nalloc] like the [nlayer][lat][lon] image variables */
+struct soil_table_s
 {
-    bool run_cell;
-    int gridcel;
-    double lat;
-    double lon;
-    double infilt;
-    double Ds;
-    double Dsmax;
-    double Ws;
-    double c;
+    int nlayer;
+    int n_cells;
+    int nalloc;                 /* stride of the per-layer fields */
+    bool organic_fract;
+    bool spatial_frost;
+    bool july_tavg_supplied;
+
+
+    int *run_cell;
+    int *gridcel;
+    double *lat;
+    double *lon;
+    double *infilt;
+    double *Ds;
+    double *Dsmax;
+    double *Ws;
+    double *c;
     double *expt;
     double *Ksat;
     double *phi_s;
     double *init_moist;
-    double elev;
+    double *elev;
     double *depth;
-    double avg_T;
-    double dp;
+    double *avg_T;
+    double *dp;
     double *bubble;
     double *quartz;
     double *bulk_density;
     double *soil_density;
 
-    /* if global_params->organic_fract */
+    /* if organic_fract */
     double *organic;
     double *bulk_dens_org;
     double *soil_dens_org;
     /* end if */
 
-    double off_gmt;
+    double *off_gmt;
     double *Wcr_FRACT;
     double *Wpwp_FRACT;
-    double rough;
-    double snow_rough;
-    double annual_prec;
+    double *rough;
+    double *snow_rough;
+    double *annual_prec;
     double *resid_moist;
-    bool fs_active;
+    int *fs_active;
 
-    /* if global_params->spatial_frost */
-    double frost_slope;
-    double max_snow_distrib_slope;
+    /* if spatial_frost */
+    double *frost_slope;
+    double *max_snow_distrib_slope;
     /* end if */
 
-    /* if global_params->july_tavg_supplied */
-    double July_Tavg;
+    /* if july_tavg_supplied */
+    double *July_Tavg;
     /* end if */
 };
 
@@ -417,7 +463,15 @@ struct soil_s
 {
     struct domain_s *domain;
     int n_cells;
-    struct soil_cell_s **cells;
+    struct soil_table_s *cells; /* sorted by lat and lon */
+    int *lat_cells;             /* index of the first cell in each lat row;
+                                 * lat->n + 1 entries */
+    int *grid_idx;              /* lat * lon->n + lon index of each cell */
+    /* streaming mode: cells is NULL and each cell is read from its offset
+     * in the soil file instead */
+    long *offsets;
+    int *run_cell;              /* for the forcing conversion */
+    int *gridcels;              /* for the state conversion */
 };
 
 struct veg_class_s
@@ -448,8 +502,17 @@ struct veg_class_s
 
 struct veg_lib_s
 {
+    struct arena_s *arena;      /* classes, their arrays and comments */
     int n_classes;
     struct veg_class_s **classes;
+    /* index into classes by veg_class - min_veg_class; -1 if missing */
+    int min_veg_class;
+    int n_class_idx;
+    int *class_idx;
+    /* unless veg_class numbers are too sparse: then the n_class_idx
+     * distinct veg_class numbers in order, class_idx holding the index of
+     * each */
+    int *veg_class_ids;
 };
 
 struct veg_cell_s
@@ -470,35 +533,110 @@ struct veg_cell_s
 
 struct veg_params_s
 {
+    int n_arenas;
+    struct arena_s *arenas;     /* per-tile arrays, one arena per thread */
     int root_zones;
     int n_cells;
-    struct veg_cell_s **cells;
+    struct veg_cell_s *cells;
+    int *gridcels;
+    /* streaming mode: cells is NULL and each cell is read from its offset
+     * in the vegparam file instead */
+    long *offsets;
+    struct gridcel_index_s *cell_idx;   /* into cells by gridcel */
+};
+
+struct snow_band_params_s
+{
+    int bands;
+    int n_cells;
+    int *gridcels;
+    /* AreaFract, elevation and Pfactor of each band; 3 * bands per cell */
+    double *values;
+    /* streaming mode: values is NULL and each cell is read from its offset
+     * in the snow band file instead */
+    long *offsets;
+    struct gridcel_index_s *cell_idx;   /* into cells by gridcel */
 };
 
+/* calendar.c */
+int days_in_month(enum calendar, int, int);
+int days_in_year(enum calendar, int);
+long date_to_days(enum calendar, int, int, int);
+const char *calendar_name(enum calendar);
+
 /* global_params.c */
 struct global_params_s *read_global_params(char *);
 void free_global_params(struct global_params_s *);
 int is_classic(struct global_params_s *);
 int is_image(struct global_params_s *);
 void populate_image_global_params(struct global_params_s *, const char *);
+int read_compress_level(const char *);
+size_t read_size(const char *);
+int read_threads(const char *);
 
 /* soil.c */
 struct soil_s *read_classic_soil(struct global_params_s *);
+struct soil_s *scan_classic_soil(struct global_params_s *);
+void read_soil_cell_at(struct global_params_s *, struct line_reader_s *,
+                       long, struct soil_table_s *, int);
+struct soil_table_s *alloc_soil_table(struct global_params_s *, int);
+void free_soil_table(struct soil_table_s *);
 void free_soil(struct soil_s *soil);
 
 /* veg_lib.c */
 struct veg_lib_s *read_classic_veg_lib(struct global_params_s *);
+int find_veg_class(struct veg_lib_s *, int);
 void free_veg_lib(struct veg_lib_s *);
 
 /* veg_params.c */
 struct veg_params_s *read_classic_veg_params(struct global_params_s *);
+struct veg_params_s *scan_classic_veg_params(struct global_params_s *);
+void read_veg_cell_at(struct global_params_s *, struct line_reader_s *,
+                      long, struct arena_s *, struct veg_cell_s *);
+struct veg_cell_s *find_veg_cell(struct veg_params_s *, int);
+long find_veg_cell_offset(struct veg_params_s *, int);
 void free_veg_params(struct veg_params_s *);
 
+/* snow_band.c */
+struct snow_band_params_s *read_classic_snow_bands(struct global_params_s
+                                                   *);
+struct snow_band_params_s *scan_classic_snow_bands(struct global_params_s
+                                                   *);
+void read_snow_band_cell_at(struct global_params_s *, struct line_reader_s *,
+                            long, double *);
+const double *find_snow_band_cell(struct snow_band_params_s *, int);
+long find_snow_band_offset(struct snow_band_params_s *, int);
+void free_snow_band_params(struct snow_band_params_s *);
+
+/* image_nc.c */
+int image_create_mode(struct global_params_s *, size_t);
+void chunk_image_vars(struct global_params_s *, int, int, int);
+void deflate_image_vars(int, int, int, int);
+void transpose_blocks(struct global_params_s *, int, int, size_t, size_t,
+                      int *, int *);
+
 /* image_domain.c */
 void create_image_domain(struct global_params_s *, struct domain_s *);
 
 /* image_params.c */
 void create_image_params(struct global_params_s *, struct soil_s *,
-                         struct veg_lib_s *, struct veg_params_s *);
+                         struct veg_lib_s *, struct veg_params_s *,
+                         struct snow_band_params_s *);
+
+/* image_forcing.c */
+void create_image_forcing(struct global_params_s *, struct soil_s *);
+void list_cell_files(struct global_params_s *, struct soil_s *, const char *,
+                     const char *, const char *);
+int is_active_cell(struct soil_s *, int);
+void cell_file_suffix(struct global_params_s *, struct soil_s *, int, char *);
+void write_scratch(int, const void *, size_t, off_t, const char *);
+void read_scratch(int, void *, size_t, off_t, const char *);
+
+/* image_history.c */
+void create_image_history(struct global_params_s *, struct soil_s *);
+
+/* image_state.c */
+void create_image_state(struct global_params_s *, struct soil_s *,
+                        struct veg_lib_s *, struct veg_params_s *);
 
 #endif